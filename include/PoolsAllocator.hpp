@@ -29,6 +29,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #if __cplusplus >= 201103L
 #include <memory>
+#include <new>
+#include <cstddef>
+#include <cstdio>
+#include <type_traits>
+#if defined( __cpp_impl_coroutine )
+#include <atomic>
+#endif
+#if defined( __has_include )
+#if __has_include( <memory_resource> )
+#include <memory_resource>
+#endif
+#endif
 
 extern "C" {
 #include "pool.h"
@@ -44,12 +56,30 @@ struct pools_allocator : public std::allocator<T>
     typedef T *pointer;
     typedef const T *const_pointer;
 
+    /* two allocators are interchangeable only when they use the same Pools, so the traits inherited from std::allocator
+     * are replaced: move assignment between containers on the same Pools steals the storage, across Pools it moves the
+     * elements one by one into the target's own Pools, and swap exchanges the allocators along with the storage */
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::false_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
     template <typename U>
     struct rebind
     {
         typedef pools_allocator<U> other;
     };
 
+#if defined( __cpp_lib_allocate_at_least )
+    typedef std::allocation_result<pointer, size_type> allocation_result;
+#else
+    struct allocation_result
+    {
+        pointer ptr;
+        size_type count;
+    };
+#endif
+
     pointer allocate( size_type n, const void *hint = 0 )
     {
         pointer p = 0;
@@ -59,11 +89,34 @@ struct pools_allocator : public std::allocator<T>
         }
         else
         {
-            p = std::allocator<T>::allocate( n, hint );
+            (void)hint;
+            p = std::allocator<T>::allocate( n );
         }
         return p;
     }
 
+    /**
+     * @brief allocate_at_least Allocate room for at least n objects, reporting how many fit in the pool element that was
+     * actually used so that the caller may grow into it without reallocating
+     */
+    allocation_result allocate_at_least( size_type n )
+    {
+        allocation_result r;
+        if ( m_pools )
+        {
+            size_t usable;
+            r.ptr = static_cast<pointer>( Pools_allocate_element( m_pools, n * sizeof( T ) ) );
+            usable = Pools_usable_size( m_pools, r.ptr );
+            r.count = usable / sizeof( T ) > n ? usable / sizeof( T ) : n;
+        }
+        else
+        {
+            r.ptr = std::allocator<T>::allocate( n );
+            r.count = n;
+        }
+        return r;
+    }
+
     void deallocate( pointer p, size_type n )
     {
         if ( m_pools )
@@ -90,6 +143,288 @@ struct pools_allocator : public std::allocator<T>
 
     Pools *m_pools;
 };
+
+/**
+ * @brief operator== Allocators are equal when they allocate from the same Pools, so that memory from one can be deallocated
+ * by the other. Declared here because the one inherited from std::allocator considers every allocator equal.
+ */
+template <typename T, typename U>
+inline bool operator==( const pools_allocator<T> &a, const pools_allocator<U> &b ) throw()
+{
+    return a.m_pools == b.m_pools;
+}
+
+template <typename T, typename U>
+inline bool operator!=( const pools_allocator<T> &a, const pools_allocator<U> &b ) throw()
+{
+    return a.m_pools != b.m_pools;
+}
+
+#if defined( __cpp_lib_memory_resource )
+
+/**
+ * @brief pools_memory_resource A std::pmr::memory_resource backed by a Pools, for use with std::pmr containers through
+ * std::pmr::polymorphic_allocator. Requests for more than fundamental alignment go to the upstream resource.
+ */
+class pools_memory_resource : public std::pmr::memory_resource
+{
+  public:
+    explicit pools_memory_resource( Pools *pools_to_use,
+                                    std::pmr::memory_resource *upstream = std::pmr::new_delete_resource() ) throw()
+        : m_pools( pools_to_use ), m_upstream( upstream )
+    {
+    }
+
+    Pools *pools() const throw() { return m_pools; }
+
+  protected:
+    void *do_allocate( size_t bytes, size_t alignment ) override
+    {
+        if ( alignment > alignof( std::max_align_t ) )
+        {
+            return m_upstream->allocate( bytes, alignment );
+        }
+        for ( ;; )
+        {
+            void *p = Pools_allocate_element( m_pools, bytes );
+            size_t usable;
+            if ( p == 0 )
+            {
+                throw std::bad_alloc();
+            }
+            if ( ( reinterpret_cast<uintptr_t>( p ) & ( alignment - 1 ) ) == 0 )
+            {
+                return p;
+            }
+            /* the element size of this class is not a multiple of the alignment, so try the next larger class; heap
+             * spills always have fundamental alignment */
+            usable = Pools_usable_size( m_pools, p );
+            Pools_deallocate_element( m_pools, p );
+            bytes = usable + 1;
+        }
+    }
+
+    void do_deallocate( void *p, size_t bytes, size_t alignment ) override
+    {
+        if ( alignment > alignof( std::max_align_t ) )
+        {
+            m_upstream->deallocate( p, bytes, alignment );
+        }
+        else
+        {
+            Pools_deallocate_element( m_pools, p );
+        }
+    }
+
+    bool do_is_equal( const std::pmr::memory_resource &other ) const noexcept override
+    {
+        const pools_memory_resource *o = dynamic_cast<const pools_memory_resource *>( &other );
+        return o && o->m_pools == m_pools;
+    }
+
+  private:
+    Pools *m_pools;
+    std::pmr::memory_resource *m_upstream;
+};
+
+#endif
+
+#if defined( __cpp_impl_coroutine )
+
+/**
+ * @brief pools_coroutine_frame_stats Counts of coroutine frames allocated through pools_promise_base, per frame size
+ */
+struct pools_coroutine_frame_stats
+{
+    enum
+    {
+        max_frame_sizes = 64
+    };
+
+    struct entry
+    {
+        std::atomic<size_t> frame_size;
+        std::atomic<size_t> num_allocations;
+        std::atomic<size_t> num_live;
+    };
+
+    /**
+     * @brief get The process wide table of frame sizes
+     */
+    static entry *get()
+    {
+        static entry entries[max_frame_sizes];
+        return entries;
+    }
+
+    /**
+     * @brief find Find or claim the entry for a frame size, or 0 if the table is full
+     */
+    static entry *find( size_t frame_size )
+    {
+        entry *entries = get();
+        for ( size_t i = 0; i < max_frame_sizes; ++i )
+        {
+            size_t current = entries[i].frame_size.load( std::memory_order_acquire );
+            if ( current == 0 )
+            {
+                entries[i].frame_size.compare_exchange_strong( current, frame_size, std::memory_order_acq_rel );
+            }
+            if ( current == 0 || current == frame_size )
+            {
+                return &entries[i];
+            }
+        }
+        return 0;
+    }
+
+    static void record_allocation( size_t frame_size )
+    {
+        if ( entry *e = find( frame_size ) )
+        {
+            e->num_allocations.fetch_add( 1, std::memory_order_relaxed );
+            e->num_live.fetch_add( 1, std::memory_order_relaxed );
+        }
+    }
+
+    static void record_deallocation( size_t frame_size )
+    {
+        if ( entry *e = find( frame_size ) )
+        {
+            e->num_live.fetch_sub( 1, std::memory_order_relaxed );
+        }
+    }
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+    /**
+     * @brief diagnostics Print one line per coroutine frame size
+     */
+    static void diagnostics( const char *prefix, int ( *print )( const char * ) )
+    {
+        entry *entries = get();
+        for ( size_t i = 0; i < max_frame_sizes; ++i )
+        {
+            size_t frame_size = entries[i].frame_size.load( std::memory_order_acquire );
+            if ( frame_size != 0 )
+            {
+                char buf[128];
+                sprintf( buf,
+                         "%s:frame_size:%6zu: num_allocations: %zu num_live: %zu",
+                         prefix,
+                         frame_size,
+                         entries[i].num_allocations.load( std::memory_order_relaxed ),
+                         entries[i].num_live.load( std::memory_order_relaxed ) );
+                print( buf );
+            }
+        }
+    }
+#endif
+};
+
+/**
+ * @brief pools_coroutine_thread_pools The Pools that coroutine frames started on this thread are allocated from, or 0 to
+ * use the global heap
+ */
+inline Pools *&pools_coroutine_thread_pools()
+{
+    static thread_local Pools *pools = 0;
+    return pools;
+}
+
+/**
+ * @brief pools_coroutine_scope Sets the calling thread's coroutine frame Pools for the lifetime of the scope
+ */
+struct pools_coroutine_scope
+{
+    explicit pools_coroutine_scope( Pools *pools ) : m_previous( pools_coroutine_thread_pools() )
+    {
+        pools_coroutine_thread_pools() = pools;
+    }
+
+    ~pools_coroutine_scope() { pools_coroutine_thread_pools() = m_previous; }
+
+    pools_coroutine_scope( const pools_coroutine_scope & ) = delete;
+    pools_coroutine_scope &operator=( const pools_coroutine_scope & ) = delete;
+
+    Pools *m_previous;
+};
+
+/**
+ * @brief pools_promise_base Base class for coroutine promise types that allocates the coroutine frame from a Pools.
+ *
+ * The frame comes from the Pools passed as the coroutine's first two parameters (std::allocator_arg, Pools *), or else
+ * from pools_coroutine_thread_pools(), or else from the global heap; at most max_frame_arguments parameters may follow
+ * the Pools. The Pools is remembered in a small header in front of the frame so that the frame may be destroyed on any
+ * thread. Pools element sizes should be multiples of header_size to keep frames aligned.
+ */
+struct pools_promise_base
+{
+    enum
+    {
+        header_size = alignof( std::max_align_t )
+    };
+
+    static void *allocate_frame( size_t size, Pools *pools )
+    {
+        void *p = pools ? Pools_allocate_element( pools, size + header_size ) : ::operator new( size + header_size );
+        if ( p == 0 )
+        {
+            throw std::bad_alloc();
+        }
+        *static_cast<Pools **>( p ) = pools;
+        pools_coroutine_frame_stats::record_allocation( size );
+        return static_cast<char *>( p ) + header_size;
+    }
+
+    static void *operator new( size_t size ) { return allocate_frame( size, pools_coroutine_thread_pools() ); }
+
+    /* the allocator_arg forms are not templates so that g++ pairs them with the sized operator delete below */
+    struct frame_argument
+    {
+        template <typename T>
+        frame_argument( T && )
+        {
+        }
+    };
+
+    enum
+    {
+        max_frame_arguments = 8
+    };
+
+    static void *operator new( size_t size, std::allocator_arg_t, Pools *pools, frame_argument = 0, frame_argument = 0,
+                               frame_argument = 0, frame_argument = 0, frame_argument = 0, frame_argument = 0,
+                               frame_argument = 0, frame_argument = 0 )
+    {
+        return allocate_frame( size, pools );
+    }
+
+    static void *operator new( size_t size, frame_argument, std::allocator_arg_t, Pools *pools, frame_argument = 0,
+                               frame_argument = 0, frame_argument = 0, frame_argument = 0, frame_argument = 0,
+                               frame_argument = 0, frame_argument = 0, frame_argument = 0 )
+    {
+        return allocate_frame( size, pools );
+    }
+
+    static void deallocate_frame( void *frame, size_t size )
+    {
+        void *p = static_cast<char *>( frame ) - header_size;
+        Pools *pools = *static_cast<Pools **>( p );
+        pools_coroutine_frame_stats::record_deallocation( size );
+        if ( pools )
+        {
+            Pools_deallocate_element( pools, p );
+        }
+        else
+        {
+            ::operator delete( p );
+        }
+    }
+
+    static void operator delete( void *frame, size_t size ) { deallocate_frame( frame, size ); }
+};
+
+#endif
 }
 
 #endif
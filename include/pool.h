@@ -30,6 +30,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #if !defined( POOL_NO_ABORT_ON_ERROR ) && !defined( POOL_ABORT )
 #define POOL_ABORT( msg )                                                                                                      \
@@ -45,6 +46,61 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
     } while ( 0 )
 #endif
 
+/**
+ * @brief POOL_FLAGS_BITS_PER_WORD The number of element allocated flags held in each allocated_flags word
+ */
+#define POOL_FLAGS_BITS_PER_WORD ( 64 )
+
+/**
+ * @brief POOL_HANDLE_INDEX_BITS The number of low bits of a handle that hold the element index
+ */
+#define POOL_HANDLE_INDEX_BITS ( 22 )
+
+/**
+ * @brief POOL_HANDLE_GENERATION_BITS The number of handle bits above the index that hold the generation of the element
+ */
+#define POOL_HANDLE_GENERATION_BITS ( 6 )
+
+/**
+ * @brief POOL_HANDLE_ID_BITS The number of top bits of a handle that hold the handle_id of the pool
+ */
+#define POOL_HANDLE_ID_BITS ( 4 )
+
+/**
+ * @brief POOL_HANDLE_INVALID The handle returned when no element could be allocated. Its index is never valid.
+ */
+#define POOL_HANDLE_INVALID ( ~(uint32_t)0 )
+
+/**
+ * @brief POOL_HANDLE_MAX_ELEMENTS The largest number of elements a pool can have and still hand out handles
+ */
+#define POOL_HANDLE_MAX_ELEMENTS ( ( (size_t)1 << POOL_HANDLE_INDEX_BITS ) - 1 )
+
+/**
+ * @brief Pool_placement_policy Selects which available element a Pool hands out next
+ */
+enum Pool_placement_policy
+{
+    /**
+     * @brief POOL_PLACEMENT_LIFO Reuse the most recently freed element first while it is still cache hot. The default.
+     * Freed elements are kept on an intrusive stack linked through their first word, so element_size must be at least
+     * sizeof( size_t ); smaller elements reuse only the last freed element and then scan upwards from it.
+     */
+    POOL_PLACEMENT_LIFO = 0,
+
+    /**
+     * @brief POOL_PLACEMENT_LOWEST_ADDRESS Always use the lowest available element, keeping the working set dense and the
+     * top of the pool idle
+     */
+    POOL_PLACEMENT_LOWEST_ADDRESS,
+
+    /**
+     * @brief POOL_PLACEMENT_ROUND_ROBIN Cycle through all elements, spreading wear and delaying the reuse of freed elements
+     * so that use after free is more likely to be noticed
+     */
+    POOL_PLACEMENT_ROUND_ROBIN
+};
+
 struct Pool
 {
     /**
@@ -57,11 +113,29 @@ struct Pool
      */
     size_t element_size;
 
+    /**
+     * @brief element_size_shift The number of trailing zero bits in element_size. Addresses are mapped to element numbers by
+     * shifting the offset right by this amount and multiplying by element_size_inverse, without any division.
+     */
+    unsigned int element_size_shift;
+
+    /**
+     * @brief element_size_inverse The multiplicative inverse modulo 2^64 of the odd part of element_size, which is 1 when
+     * element_size is a power of two
+     */
+    uint64_t element_size_inverse;
+
     /**
      * @brief next_available_hint The best guess of the next available element
      */
     size_t next_available_hint;
 
+    /**
+     * @brief free_stack_top One more than the most recently freed element under POOL_PLACEMENT_LIFO, or 0 when the stack
+     * is empty. Each element on the stack holds the free_stack_top that was current when it was freed in its first word.
+     */
+    size_t free_stack_top;
+
     /**
      * @brief element_storage_size The total size in bytes of the element_storage buffer
      */
@@ -73,9 +147,52 @@ struct Pool
     size_t total_allocated_items;
 
     /**
-     * @brief allocated_flags The storage for the bit map of allocated/deallocated flags. One bit per element
+     * @brief allocated_flags The storage for the bit map of allocated/deallocated flags. One bit per element, packed into
+     * POOL_FLAGS_BITS_PER_WORD bit words so that it can be scanned a word at a time. The bits past num_elements in the last
+     * word are always set.
+     */
+    uint64_t *allocated_flags;
+
+    /**
+     * @brief full_flag_words Summary bit map with one bit per allocated_flags word, set when every element in that word is
+     * allocated, so that scans can skip full regions 4096 elements at a time. Shares the allocation of allocated_flags.
      */
-    unsigned char *allocated_flags;
+    uint64_t *full_flag_words;
+
+    /**
+     * @brief dirty_flags One bit per element, set when the element is deallocated. A clear bit means the element has never
+     * been handed out and still holds the zeros the storage was initialized with. Shares the allocation of allocated_flags.
+     */
+    uint64_t *dirty_flags;
+
+    /**
+     * @brief remote_free_flags One bit per element, set atomically while the element waits on a remote free list so that a
+     * second free of it is caught before it can be linked in twice. Shares the allocation of allocated_flags.
+     */
+    uint64_t *remote_free_flags;
+
+    /**
+     * @brief generations One counter per element, incremented each time the element is deallocated, so that handles to an
+     * element that has since been freed can be told apart. 0 unless Pool_enable_handle_generations was called.
+     */
+    uint8_t *generations;
+
+    /**
+     * @brief handle_id The pool id that Pool_allocate_handle puts in the top bits of each handle. Assigned by Pools so that
+     * handles stay valid when pools are moved within its array.
+     */
+    unsigned int handle_id;
+
+    /**
+     * @brief tags The tag of each allocated element, written by Pools so that a free is charged back to the tag that
+     * allocated it. 0 unless Pool_enable_tags was called.
+     */
+    uint8_t *tags;
+
+    /**
+     * @brief placement_policy The policy used to choose the next available element
+     */
+    enum Pool_placement_policy placement_policy;
 
     /**
      * @brief element_storage The storage for all of the element
@@ -97,6 +214,17 @@ struct Pool
      */
     size_t diag_num_spills;
 
+    /**
+     * @brief diag_num_clears Diagnostics counter for the number of zeroed allocations that had to clear a recycled element
+     */
+    size_t diag_num_clears;
+
+    /**
+     * @brief diag_num_clears_skipped Diagnostics counter for the number of zeroed allocations of elements that were never
+     * used, which needed no clearing
+     */
+    size_t diag_num_clears_skipped;
+
     /**
      * @brief diag_multiple_allocation_errors Diagnostics counter for the number of times an element was allocated more than
      * once at a time
@@ -135,6 +263,88 @@ int Pool_init( struct Pool *self,
                void *( *low_level_allocation_function )( size_t ),
                void ( *low_level_free_function )( void * ) );
 
+/**
+ * @brief Pool_init_zeroed              Initialize a Pool with storage from a calloc style function that returns zeroed
+ *                                      memory, such as calloc itself or anonymous mmap. The storage is not cleared again,
+ *                                      so pages that are never used are never touched.
+ * @param self                          Pointer to Pool struct to initialize
+ * @param num_elements                  The number of elements to allocate. May be 0 to disable Pool.
+ * @param element_size                  The size of each element in bytes.May be 0 to disable Pool.
+ * @param low_level_zeroed_allocation_function Pointer to low level zeroed memory allocation function taking a count and a
+ *                                      size
+ * @param low_level_free_function       Pointer to low level memory free function
+ * @return                              -1 on error, 0 on success
+ */
+int Pool_init_zeroed( struct Pool *self,
+                      size_t num_elements,
+                      size_t element_size,
+                      void *( *low_level_zeroed_allocation_function )( size_t, size_t ),
+                      void ( *low_level_free_function )( void * ) );
+
+/**
+ * @brief Pool_init_placed              Initialize a Pool like Pool_init_zeroed if a zeroed allocation function is given, or
+ *                                      else like Pool_init, and call place_storage after the storage is allocated and
+ *                                      before it is first written, for instance to bind it to a NUMA node so that its
+ *                                      pages are placed there rather than migrated there.
+ * @param self                          Pointer to Pool struct to initialize
+ * @param num_elements                  The number of elements to allocate. May be 0 to disable Pool.
+ * @param element_size                  The size of each element in bytes.May be 0 to disable Pool.
+ * @param low_level_allocation_function Pointer to low level memory allocation function, also kept for side tables when a
+ *                                      zeroed allocation function is given
+ * @param low_level_zeroed_allocation_function Pointer to low level zeroed memory allocation function, or 0
+ * @param low_level_free_function       Pointer to low level memory free function
+ * @param place_storage                 Function called with context and the pool once its element storage is allocated,
+ *                                      or 0
+ * @param context                       Passed to place_storage
+ * @return                              -1 on error, 0 on success
+ */
+int Pool_init_placed( struct Pool *self,
+                      size_t num_elements,
+                      size_t element_size,
+                      void *( *low_level_allocation_function )( size_t ),
+                      void *( *low_level_zeroed_allocation_function )( size_t, size_t ),
+                      void ( *low_level_free_function )( void * ),
+                      void ( *place_storage )( void *context, struct Pool *pool ),
+                      void *context );
+
+/**
+ * @brief Pool_init_view                Initialize a Pool over flag and element storage that is owned elsewhere, for instance
+ *                                      in a shared memory segment. Nothing is allocated or cleared, and Pool_terminate will
+ *                                      not free the storage.
+ * @param self                          Pointer to Pool struct to initialize
+ * @param num_elements                  The number of elements in the storage
+ * @param element_size                  The size of each element in bytes
+ * @param allocated_flags               Pointer to Pool_allocated_flags_size( num_elements ) bytes of flags
+ * @param element_storage               Pointer to num_elements * element_size bytes of element storage
+ */
+void Pool_init_view( struct Pool *self,
+                     size_t num_elements,
+                     size_t element_size,
+                     uint64_t *allocated_flags,
+                     unsigned char *element_storage );
+
+/**
+ * @brief Pool_allocated_flags_size     Calculate the size of the allocated flags, their summary, the dirty flags and
+ *                                      the remote free flags for a Pool
+ * @param num_elements                  The number of elements in the Pool
+ * @return                              The size in bytes
+ */
+size_t Pool_allocated_flags_size( size_t num_elements );
+
+/**
+ * @brief Pool_clear_allocated_flags    Mark every element of a Pool as available and never used. The element storage
+ *                                      must be zero.
+ * @param self                          Pointer to Pool struct
+ */
+void Pool_clear_allocated_flags( struct Pool *self );
+
+/**
+ * @brief Pool_set_placement_policy     Choose how a Pool picks the next available element. Call right after Pool_init.
+ * @param self                          Pointer to Pool struct
+ * @param placement_policy              The placement policy to use
+ */
+void Pool_set_placement_policy( struct Pool *self, enum Pool_placement_policy placement_policy );
+
 /**
  * @brief Pool_terminate            Terminate a Pool and deallocate low level buffers
  * @param self                      Pointer to the Pool to terminate
@@ -148,13 +358,21 @@ void Pool_terminate( struct Pool *self );
  */
 void *Pool_allocate_element( struct Pool *self );
 
+/**
+ * @brief Pool_allocate_zeroed_element Allocate one element that is filled with zeros. Elements that were never handed
+ *                                  out are already zero and are not cleared again.
+ * @param self                      The pool to allocate from
+ * @return                          0 if the pool is full, or pointer to the zeroed element
+ */
+void *Pool_allocate_zeroed_element( struct Pool *self );
+
 /**
  * @brief Pool_deallocate_element   Deallocate one element from the pool
  * @param self                      The pool to deallocate from
  * @param p                         The pointer to deallocate
  * @return                          -1 if the item is not allocated from this pool, or the item index if positive
  */
-int Pool_deallocate_element( struct Pool *self, void *p );
+ssize_t Pool_deallocate_element( struct Pool *self, void *p );
 
 /**
  * @brief Pool_is_element_available Check to see if a specific element index is available
@@ -178,6 +396,15 @@ void Pool_mark_element_allocated( struct Pool *self, size_t element_num );
  */
 void Pool_mark_element_available( struct Pool *self, size_t element_num );
 
+/**
+ * @brief Pool_mark_element_remote_free Atomically mark an allocated element as waiting on a remote free list. Safe to
+ *                                      call from any thread; cleared again when the element is marked available.
+ * @param self                          The Pool to use
+ * @param element_num                   The element index to mark
+ * @return                              0 on success, -1 if the element is not allocated or is already waiting to be freed
+ */
+int Pool_mark_element_remote_free( struct Pool *self, size_t element_num );
+
 /**
  * @brief Pool_get_address_for_element  Calculate the memory address of a specific element
  * @param self                          The Pool to use
@@ -202,8 +429,76 @@ int Pool_is_address_in_pool( struct Pool *self, void const *p );
  * in this Pool
  */
 ssize_t Pool_get_element_for_address( struct Pool *self, void const *p );
+
+/**
+ * @brief Pool_find_next_available_element Find the element that the placement policy would hand out next: the top of
+ * the free stack under POOL_PLACEMENT_LIFO, otherwise the first clear allocated flag at or after next_available_hint
+ * found a word at a time
+ * @param self                          The Pool to use
+ * @return                              The element number, or -1 if the Pool is full
+ */
 ssize_t Pool_find_next_available_element( struct Pool *self );
 
+/**
+ * @brief Pool_count_allocated          Count the allocated elements by population count of the allocated flags, independent
+ * of total_allocated_items
+ * @param self                          The Pool to use
+ * @return                              The number of elements whose allocated flag is set
+ */
+size_t Pool_count_allocated( struct Pool *self );
+
+/**
+ * @brief Pool_for_each_allocated       Call a function for each allocated element in address order, skipping whole
+ * available words. The callback may deallocate the element it is given.
+ * @param self                          The Pool to use
+ * @param callback                      The function to call with the context, the Pool and the element; a non zero return
+ * stops the walk
+ * @param context                       Passed through to the callback
+ * @return                              The number of elements the callback was called for
+ */
+size_t Pool_for_each_allocated( struct Pool *self,
+                                int ( *callback )( void *context, struct Pool *pool, void *element ),
+                                void *context );
+
+/**
+ * @brief Pool_enable_handle_generations Allocate a generation counter for each element so that handles to freed elements
+ * no longer resolve, up to 2^POOL_HANDLE_GENERATION_BITS reuses later
+ * @param self                          The Pool to use
+ * @return                              -1 if the counters could not be allocated, 0 on success
+ */
+int Pool_enable_handle_generations( struct Pool *self );
+
+/**
+ * @brief Pool_enable_tags              Allocate a one byte tag for each element, for per tag accounting by Pools
+ * @param self                          The Pool to use
+ * @return                              -1 if the tags could not be allocated, 0 on success
+ */
+int Pool_enable_tags( struct Pool *self );
+
+/**
+ * @brief Pool_allocate_handle      Allocate one element and return a 32 bit handle to it instead of a pointer
+ * @param self                      The pool to allocate from
+ * @return                          POOL_HANDLE_INVALID if the pool is full or has more than POOL_HANDLE_MAX_ELEMENTS
+ *                                  elements, or the handle made of handle_id, generation and element index
+ */
+uint32_t Pool_allocate_handle( struct Pool *self );
+
+/**
+ * @brief Pool_handle_to_ptr        Resolve a handle with one multiply and no division
+ * @param self                      The Pool the handle was allocated from
+ * @param handle                    The handle to resolve
+ * @return                          Pointer to the element, or 0 if the handle belongs to another pool, is out of range, or
+ *                                  has a stale generation
+ */
+void *Pool_handle_to_ptr( struct Pool *self, uint32_t handle );
+
+/**
+ * @brief Pool_deallocate_handle    Deallocate the element a handle refers to. Aborts if the handle does not resolve.
+ * @param self                      The Pool the handle was allocated from
+ * @param handle                    The handle to deallocate
+ */
+void Pool_deallocate_handle( struct Pool *self, uint32_t handle );
+
 #if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
 /**
  * @brief Pool_diagnostics          Print pool diagnostics counters
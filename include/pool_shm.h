@@ -0,0 +1,210 @@
+#ifndef pool_shm_h
+#define pool_shm_h
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "pool.h"
+
+/**
+ * @brief POOL_SHM_MAGIC The first 8 bytes of an initialized shared memory Pool segment, "PLSHMPL1" in little endian
+ */
+#define POOL_SHM_MAGIC ( 0x314c504d48534c50ULL )
+
+/**
+ * @brief PoolShm_header The header at the start of a shared memory Pool segment. Everything in the segment is located by
+ * offsets from the start of the segment so that each process may map it at a different address.
+ */
+struct PoolShm_header
+{
+    /**
+     * @brief magic POOL_SHM_MAGIC once the creator has finished initializing the segment
+     */
+    uint64_t magic;
+
+    /**
+     * @brief segment_size The total size in bytes of the segment
+     */
+    uint64_t segment_size;
+
+    /**
+     * @brief num_elements The number of elements in the pool
+     */
+    uint64_t num_elements;
+
+    /**
+     * @brief element_size The size in bytes of each element
+     */
+    uint64_t element_size;
+
+    /**
+     * @brief allocated_flags_offset The offset of the allocated flag words from the start of the segment
+     */
+    uint64_t allocated_flags_offset;
+
+    /**
+     * @brief element_storage_offset The offset of the element storage from the start of the segment
+     */
+    uint64_t element_storage_offset;
+
+    /**
+     * @brief next_available_hint The best guess of the next available element, shared by all processes
+     */
+    uint64_t next_available_hint;
+
+    /**
+     * @brief total_allocated_items The total number of items that are currently allocated by all processes
+     */
+    uint64_t total_allocated_items;
+
+    /**
+     * @brief diag_num_allocations Diagnostics counter for the number of allocations
+     */
+    uint64_t diag_num_allocations;
+
+    /**
+     * @brief diag_num_frees Diagnostics counter for the number of frees
+     */
+    uint64_t diag_num_frees;
+
+    /**
+     * @brief diag_num_spills Diagnostics counter for the number of allocations that failed because the pool was full
+     */
+    uint64_t diag_num_spills;
+
+    /**
+     * @brief diag_multiple_deallocation_errors Diagnostics counter for the number of times an element was deallocated more
+     * than once at a time
+     */
+    uint64_t diag_multiple_deallocation_errors;
+};
+
+struct PoolShm
+{
+    /**
+     * @brief header The mapped segment header
+     */
+    struct PoolShm_header *header;
+
+    /**
+     * @brief view A process local Pool over the mapped flags and storage, used for address to element mapping
+     */
+    struct Pool view;
+};
+
+/**
+ * @brief PoolShm_create                Create, size and initialize a named shared memory Pool segment and map it. Names of
+ *                                      the form "/name" are POSIX shared memory objects; any other name is a file path.
+ * @param self                          Pointer to PoolShm struct to initialize
+ * @param name                          The name of the segment. Creation fails with errno EEXIST if a segment of
+ *                                      that name exists; remove it with PoolShm_unlink first if it is stale.
+ * @param num_elements                  The number of elements
+ * @param element_size                  The size of each element in bytes
+ * @return                              -1 on error, 0 on success
+ */
+int PoolShm_create( struct PoolShm *self, const char *name, size_t num_elements, size_t element_size );
+
+/**
+ * @brief PoolShm_open                  Map an existing shared memory Pool segment created by PoolShm_create
+ * @param self                          Pointer to PoolShm struct to initialize
+ * @param name                          The name of the segment
+ * @return                              -1 on error, if the segment is not initialized yet or if its layout does not fit
+ *                                      its size, 0 on success
+ */
+int PoolShm_open( struct PoolShm *self, const char *name );
+
+/**
+ * @brief PoolShm_close                 Unmap the segment from this process. The segment and its allocations persist.
+ * @param self                          Pointer to PoolShm struct
+ */
+void PoolShm_close( struct PoolShm *self );
+
+/**
+ * @brief PoolShm_unlink                Remove the name of a shared memory Pool segment
+ * @param name                          The name of the segment
+ * @return                              -1 on error, 0 on success
+ */
+int PoolShm_unlink( const char *name );
+
+/**
+ * @brief PoolShm_allocate_index        Atomically claim an available element. Safe to call concurrently from any thread in
+ *                                      any process that has the segment mapped.
+ * @param self                          Pointer to PoolShm struct
+ * @return                              The element index, or -1 if the pool is full
+ */
+ssize_t PoolShm_allocate_index( struct PoolShm *self );
+
+/**
+ * @brief PoolShm_deallocate_index      Atomically release an element. Any process may release an element that another
+ *                                      process allocated.
+ * @param self                          Pointer to PoolShm struct
+ * @param element_num                   The element index
+ * @return                              -1 if the element was not allocated, 0 on success
+ */
+int PoolShm_deallocate_index( struct PoolShm *self, size_t element_num );
+
+/**
+ * @brief PoolShm_allocate_element      Atomically claim an available element and return its address in this process
+ * @param self                          Pointer to PoolShm struct
+ * @return                              0 if the pool is full, or pointer to the element
+ */
+void *PoolShm_allocate_element( struct PoolShm *self );
+
+/**
+ * @brief PoolShm_deallocate_element    Release an element given its address in this process
+ * @param self                          Pointer to PoolShm struct
+ * @param p                             Pointer to the element
+ * @return                              -1 if p is not an allocated element of this pool, or the element index
+ */
+ssize_t PoolShm_deallocate_element( struct PoolShm *self, void *p );
+
+/**
+ * @brief PoolShm_get_address_for_element Calculate the address of an element in this process
+ * @param self                          Pointer to PoolShm struct
+ * @param element_num                   The element index, as handed over by another process
+ * @return                              Pointer to the element, or 0 if the element_num is out of range
+ */
+void *PoolShm_get_address_for_element( struct PoolShm *self, size_t element_num );
+
+/**
+ * @brief PoolShm_get_element_for_address Calculate the element index of an address in this process
+ * @param self                          Pointer to PoolShm struct
+ * @param p                             Pointer to the element
+ * @return                              The element index, or -1 if p does not point to the beginning of an element
+ */
+ssize_t PoolShm_get_element_for_address( struct PoolShm *self, void const *p );
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+/**
+ * @brief PoolShm_diagnostics           Print the shared diagnostics counters
+ * @param self                          Pointer to PoolShm struct to diagnose
+ * @param prefix                        Pointer to cstring which will be put in front of each line outputted
+ * @param print                         Pointer to function to be called for each line of text
+ */
+void PoolShm_diagnostics( struct PoolShm *self, const char *prefix, int ( *print )( const char * ) );
+#endif
+
+#endif
@@ -28,9 +28,56 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "pool.h"
+#include "pools_trace.h"
+#include "pools_profile.h"
+#include "pools_epoch.h"
 
 #define POOLS_MAX_POOLS ( 16 )
 
+#if POOLS_MAX_POOLS > ( 1 << POOL_HANDLE_ID_BITS )
+#error "POOLS_MAX_POOLS needs more handle id bits"
+#endif
+
+/**
+ * @brief POOLS_MAX_TAGS The number of tags that allocations can be accounted to. Tag 0 is used by the untagged entry points.
+ */
+#define POOLS_MAX_TAGS ( 16 )
+
+struct PoolsMaintainer;
+
+/**
+ * @brief Pools_tag The budget and pool occupancy of one tag, for instance one tenant. Only the owner thread allocates and
+ * frees from other threads reach it through the remote free list, so the counters are plain owner thread counters.
+ */
+struct Pools_tag
+{
+    /**
+     * @brief max_bytes The most element bytes the tag may hold in the pools, or 0 for no limit
+     */
+    size_t max_bytes;
+
+    /**
+     * @brief max_elements The most elements the tag may hold in the pools, or 0 for no limit
+     */
+    size_t max_elements;
+
+    /**
+     * @brief num_bytes The element bytes the tag currently holds in the pools
+     */
+    size_t num_bytes;
+
+    /**
+     * @brief num_elements The number of elements the tag currently holds in the pools
+     */
+    size_t num_elements;
+
+    /**
+     * @brief diag_num_over_budget Diagnostics counter of the allocations that were refused because the tag was at its
+     * budget
+     */
+    size_t diag_num_over_budget;
+};
+
 struct Pools
 {
     /**
@@ -74,14 +121,146 @@ struct Pools
      * @brief name The name of this collection of Pools
      */
     const char *name;
+
+    /**
+     * @brief owner_thread The identity of the thread that owns this Pools, as returned by Pools_current_thread(). Only the
+     * owner may allocate; any thread may deallocate.
+     */
+    const void *owner_thread;
+
+    /**
+     * @brief remote_free_head Lock-free MPSC list of elements freed by non-owner threads, linked through the first word of
+     * each freed element. Drained by the owner on its next allocation.
+     */
+    void *remote_free_head;
+
+    /**
+     * @brief diag_num_remote_frees Diagnostics counter of the number of elements pushed onto the remote free list. Counted
+     * before each push, so that a drain knows the most elements the list can hold.
+     */
+    size_t diag_num_remote_frees;
+
+    /**
+     * @brief num_remote_frees_drained The number of elements the owner has taken off the remote free list. A drain that
+     * finds more than diag_num_remote_frees - num_remote_frees_drained elements has found a cycle.
+     */
+    size_t num_remote_frees_drained;
+
+    /**
+     * @brief diag_num_remote_drains Diagnostics counter of the number of times the owner drained a non-empty remote free list
+     */
+    size_t diag_num_remote_drains;
+
+    /**
+     * @brief numa_node The NUMA node that the element storage of this Pools is bound to, or -1 if unbound
+     */
+    int numa_node;
+
+    /**
+     * @brief diag_num_bind_failures Diagnostics counter of the number of pools whose storage could not be bound to numa_node
+     */
+    size_t diag_num_bind_failures;
+
+    /**
+     * @brief low_level_reallocation_function The pointer to the system's low level reallocation function, used to resize
+     * items that were spilled to the heap. May be 0, in which case they are moved by allocate, copy and free.
+     */
+    void *( *low_level_reallocation_function )( void *, size_t );
+
+    /**
+     * @brief low_level_zeroed_allocation_function The pointer to a calloc style function that returns zeroed memory, used
+     * for the storage of new pools and for zeroed heap spills. May be 0.
+     */
+    void *( *low_level_zeroed_allocation_function )( size_t, size_t );
+
+    /**
+     * @brief diag_num_reallocs_in_place Diagnostics counter of the number of reallocations that fit in the existing
+     * element
+     */
+    size_t diag_num_reallocs_in_place;
+
+    /**
+     * @brief diag_num_reallocs_moved Diagnostics counter of the number of reallocations that had to move to a different
+     * element or to the heap
+     */
+    size_t diag_num_reallocs_moved;
+
+    /**
+     * @brief trace The allocation trace recorder. Recording is enabled while trace.header is not 0.
+     */
+    struct Pools_trace trace;
+
+    /**
+     * @brief profile The sampling allocation profiler. Sampling is enabled while profile.sites is not 0.
+     */
+    struct Pools_profile profile;
+
+    /**
+     * @brief epoch The epoch based deferred reclamation state used by Pools_retire
+     */
+    struct Pools_epoch epoch;
+
+    /**
+     * @brief handle_generations Set by Pools_enable_handle_generations; pools added afterwards get generation counters too
+     */
+    int handle_generations;
+
+    /**
+     * @brief handle_pool_index The index in pool of the pool with each handle_id, as last seen by Pools_handle_to_ptr.
+     * Checked against the handle_id on every lookup and refreshed when a pool has moved.
+     */
+    unsigned char handle_pool_index[POOLS_MAX_POOLS];
+
+    /**
+     * @brief next_handle_id Where the search for a free handle_id starts when the next pool is added or inserted
+     */
+    unsigned int next_handle_id;
+
+    /**
+     * @brief tagging Set by the first Pools_set_tag_budget; from then on every pool element records the tag it was
+     * allocated for
+     */
+    int tagging;
+
+    /**
+     * @brief tag The budget and occupancy of each tag
+     */
+    struct Pools_tag tag[POOLS_MAX_TAGS];
+
+    /**
+     * @brief maintainer The background maintainer that grows and trims the pools, or 0. It hands its work to the owner,
+     * which applies it on its next allocation, so the entry points never wait for it.
+     */
+    struct PoolsMaintainer *maintainer;
+
+    /**
+     * @brief layout_sequence Odd while the owner is inserting or removing pools. Other threads read it before and after
+     * looking at the pool array and look again if it changed.
+     */
+    size_t layout_sequence;
+
+    /**
+     * @brief num_layout_readers The number of non-owner threads looking up pools. Pools removed from the array are only
+     * terminated once this has been seen at 0, since those threads may still be using a copy of them.
+     */
+    size_t num_layout_readers;
 };
 
+/**
+ * @brief Pools_current_thread         Get a cheap identity token for the calling thread
+ * @return                              A pointer that is unique to the calling thread for its lifetime
+ */
+const void *Pools_current_thread( void );
+
 /**
  * @brief Pools_init                    Initialize a Pools structure, a set of POOLS_MAX_POOLS pools
  * @param self                          Pointer to Pools struct to init
  * @param name                          Pointer to string of name of this collection of pools
- * @param low_level_allocation_function Pointer to low level memory allocation function
- * @param low_level_free_function       Pointer to low level memory free function
+ * @param low_level_allocation_function Pointer to low level memory allocation function. It must be thread safe if
+ *                                      Pools_epoch_register or Pools_retire are used, since they call it from the calling
+ *                                      thread, or if a PoolsMaintainer is attached, since it grows pools on its own thread.
+ * @param low_level_free_function       Pointer to low level memory free function, which must be thread safe under the same
+ *                                      conditions
  * @return                              -1 on error, 0 on success
  */
 int Pools_init( struct Pools *self,
@@ -89,15 +268,95 @@ int Pools_init( struct Pools *self,
                 void *( *low_level_allocation_function )( size_t ),
                 void ( *low_level_free_function )( void * ) );
 
+/**
+ * @brief Pools_set_owner_thread        Make the calling thread the owner of the Pools. The owner is the only thread that may
+ *                                      allocate from the Pools; Pools_init makes the initializing thread the owner.
+ * @param self                          Pointer to Pools struct
+ */
+void Pools_set_owner_thread( struct Pools *self );
+
+/**
+ * @brief Pools_set_low_level_reallocation_function Set the function used to resize items that were spilled to the heap
+ * @param self                          Pointer to Pools struct
+ * @param low_level_reallocation_function Pointer to low level memory reallocation function, such as realloc, or 0
+ */
+void Pools_set_low_level_reallocation_function( struct Pools *self,
+                                                void *( *low_level_reallocation_function )( void *, size_t ) );
+
+/**
+ * @brief Pools_set_low_level_zeroed_allocation_function Set a calloc style function that returns zeroed memory. Pools
+ * added afterwards take their storage from it without clearing it again, so their untouched pages stay untouched, and
+ * Pools_allocate_zeroed spills to the heap with it.
+ * @param self                          Pointer to Pools struct
+ * @param low_level_zeroed_allocation_function Pointer to low level zeroed allocation function, such as calloc, or 0
+ */
+void Pools_set_low_level_zeroed_allocation_function( struct Pools *self,
+                                                     void *( *low_level_zeroed_allocation_function )( size_t, size_t ) );
+
+/**
+ * @brief Pools_init_pool               Initialize a Pool with the low level functions of a Pools, without adding it. If the
+ *                                      Pools has a numa_node, the storage is bound to it before it is first written.
+ *                                      Its handle_id and side tables are set up by Pools_insert_pool.
+ * @param self                          Pointer to Pools struct whose low level functions are used
+ * @param pool                          Pointer to the Pool struct to initialize
+ * @param element_size                  The size of the element for the pool
+ * @param num_elements                  The number of elements for the pool
+ * @return                              -1 on error, 0 on success
+ */
+int Pools_init_pool( struct Pools *self, struct Pool *pool, size_t element_size, size_t number_of_elements );
+
+/**
+ * @brief Pools_insert_pool             Insert an initialized pool after the last pool of its element size, or at the end,
+ *                                      so that each class is still searched in order. Must be called by the owner thread.
+ * @param self                          Pointer to Pools struct
+ * @param pool                          The pool to insert, which is given its handle_id and the side tables the Pools
+ *                                      uses before it is copied into the array
+ * @return                              -1 if there are already POOLS_MAX_POOLS pools or a side table cannot be
+ *                                      allocated, 0 on success
+ */
+int Pools_insert_pool( struct Pools *self, struct Pool *pool );
+
+/**
+ * @brief Pools_remove_pool             Remove a pool from the array without terminating it. Must be called by the owner
+ *                                      thread; the removed pool may only be terminated once num_layout_readers is 0.
+ * @param self                          Pointer to Pools struct
+ * @param index                         The index of the pool to remove
+ * @param removed                       Receives the removed pool
+ */
+void Pools_remove_pool( struct Pools *self, size_t index, struct Pool *removed );
+
+/**
+ * @brief Pools_copy_layout             Copy the pool array as it was at one instant, from any thread. The copies are only
+ *                                      good for their sizes and addresses, and their counters are a snapshot.
+ * @param self                          Pointer to Pools struct
+ * @param pools                         Receives up to POOLS_MAX_POOLS pools
+ * @return                              The number of pools copied
+ */
+size_t Pools_copy_layout( struct Pools *self, struct Pool *pools );
+
 /**
  * @brief Pools_add                     Add a pool to a set of Pools
  * @param self                          Pointer to Pools struct to add a pool to
- * @param element_size                  The size of the element for this new pool
+ * @param element_size                  The size of the element for this new pool. Sizes smaller than a pointer are rounded
+ *                                      up so that a freed element can hold the remote free list link.
  * @param num_elements                  The number of elements for this new pool
  * @return                              -1 on error, 0 on success
  */
 int Pools_add( struct Pools *self, size_t element_size, size_t number_of_elements );
 
+/**
+ * @brief Pools_add_with_policy         Add a pool that uses a specific placement policy to a set of Pools
+ * @param self                          Pointer to Pools struct to add a pool to
+ * @param element_size                  The size of the element for this new pool
+ * @param num_elements                  The number of elements for this new pool
+ * @param placement_policy              The placement policy for this new pool
+ * @return                              -1 on error, 0 on success
+ */
+int Pools_add_with_policy( struct Pools *self,
+                           size_t element_size,
+                           size_t number_of_elements,
+                           enum Pool_placement_policy placement_policy );
+
 /**
  * @brief Pools_terminate           Terminate a Pools and deallocate low level buffers used by all
  *                                  pools except the spills onto the heap.
@@ -114,14 +373,190 @@ void Pools_terminate( struct Pools *self );
  */
 void *Pools_allocate_element( struct Pools *self, size_t size );
 
+/**
+ * @brief Pools_allocate_zeroed     Allocate an item filled with zeros, like calloc. Pool elements that were never handed
+ * out are known to be zero already and are not cleared again; recycled elements are.
+ * @param self                      Pointer to Pools struct
+ * @param size                      Size of the item to allocate
+ * @return                          pointer to allocated zeroed item, or 0 on error
+ */
+void *Pools_allocate_zeroed( struct Pools *self, size_t size );
+
+/**
+ * @brief Pools_allocate_tagged     Allocate an item on behalf of a tag. While the tag is at its budget nothing is allocated,
+ * neither from the pools nor from the heap, so that one tag can neither use up a class that the others depend on nor
+ * grow without bound on the heap spill path.
+ * @param self                      Pointer to Pools struct
+ * @param size                      Size of the item to allocate
+ * @param tag                       The tag to charge, below POOLS_MAX_TAGS
+ * @return                          pointer to allocated item, or 0 on error or if the tag is at its budget
+ */
+void *Pools_allocate_tagged( struct Pools *self, size_t size, unsigned int tag );
+
+/**
+ * @brief Pools_set_tag_budget      Limit the pool occupancy of a tag. The first call enables tagging, which gives every
+ * pool a one byte tag per element and charges the elements already allocated to tag 0. Allocations for a tag at its
+ * budget return 0 rather than spill to the heap. Only requests larger than every pool's element size go to the heap
+ * uncharged, as they always do.
+ * @param self                      Pointer to Pools struct
+ * @param tag                       The tag to limit, below POOLS_MAX_TAGS
+ * @param max_bytes                 The most element bytes the tag may hold, or 0 for no limit
+ * @param max_elements              The most elements the tag may hold, or 0 for no limit
+ * @return                          -1 if the tag is out of range or the tags could not be allocated, 0 on success
+ */
+int Pools_set_tag_budget( struct Pools *self, unsigned int tag, size_t max_bytes, size_t max_elements );
+
+/**
+ * @brief Pools_allocate_handle     Allocate an element from the best Pool with room and return a 32 bit handle to it. Never
+ * spills to the heap, since heap items have no handle. The element is charged to tag 0.
+ * @param self                      Pointer to Pools struct
+ * @param size                      Size of the item to allocate
+ * @return                          The handle, or POOL_HANDLE_INVALID if no pool has room
+ */
+uint32_t Pools_allocate_handle( struct Pools *self, size_t size );
+
+/**
+ * @brief Pools_allocate_handle_tagged Allocate a handle like Pools_allocate_handle on behalf of a tag. While the tag is at
+ * its budget no handle is allocated, since handles never spill to the heap.
+ * @param self                      Pointer to Pools struct
+ * @param size                      Size of the item to allocate
+ * @param tag                       The tag to charge, below POOLS_MAX_TAGS
+ * @return                          The handle, or POOL_HANDLE_INVALID if no pool has room or the tag is at its budget
+ */
+uint32_t Pools_allocate_handle_tagged( struct Pools *self, size_t size, unsigned int tag );
+
+/**
+ * @brief Pools_handle_to_ptr       Resolve a handle from Pools_allocate_handle, from any thread. Pool ids are kept when
+ * the maintainer moves pools, so handles stay valid for as long as their element is allocated.
+ * @param self                      Pointer to Pools struct
+ * @param handle                    The handle to resolve
+ * @return                          Pointer to the element, or 0 if the handle does not resolve
+ */
+void *Pools_handle_to_ptr( struct Pools *self, uint32_t handle );
+
+/**
+ * @brief Pools_deallocate_handle   Deallocate the element a handle refers to, from any thread like Pools_deallocate_element.
+ * Aborts if the handle does not resolve.
+ * @param self                      Pointer to Pools struct
+ * @param handle                    The handle to deallocate
+ */
+void Pools_deallocate_handle( struct Pools *self, uint32_t handle );
+
+/**
+ * @brief Pools_enable_handle_generations Give every pool, including pools added later, per element generation counters so
+ * that handles to freed elements stop resolving
+ * @param self                      Pointer to Pools struct
+ * @return                          -1 if the counters could not be allocated, 0 on success
+ */
+int Pools_enable_handle_generations( struct Pools *self );
+
 /**
  * @brief Pools_deallocate_element  Find the pool that a pointer was allocated from and do the appropriate thing to de-allocate
- * it.
+ * it. May be called from any thread: when called from a thread other than the owner, pool elements are pushed onto the
+ * lock-free remote free list and heap spills are freed directly with the low level free function, which must then be thread
+ * safe.
  * @param self                      Pointer to Pools struct
  * @param p                         Pointer to allocated item
  */
 void Pools_deallocate_element( struct Pools *self, void *p );
 
+/**
+ * @brief Pools_reallocate          Resize an item. Items whose pool element already fits new_size are returned unchanged;
+ * items that outgrow their element are moved to the best fitting Pool or the heap; items that were spilled to the heap are
+ * resized with the low level reallocation function when one is set.
+ * @param self                      Pointer to Pools struct
+ * @param p                         Pointer to allocated item, or 0 to allocate a new item
+ * @param old_size                  The size that was requested when p was allocated; the number of bytes to preserve
+ * @param new_size                  The new size of the item. 0 deallocates p and returns 0.
+ * @return                          pointer to the resized item, or 0 on error in which case p is still allocated
+ */
+void *Pools_reallocate( struct Pools *self, void *p, size_t old_size, size_t new_size );
+
+/**
+ * @brief Pools_usable_size         Get the number of bytes that may actually be used at an item, which is the element_size
+ * of the pool that owns it and may be larger than the size that was requested
+ * @param self                      Pointer to Pools struct
+ * @param p                         Pointer to allocated item
+ * @return                          The usable size in bytes, or 0 if p was not allocated from any pool (for instance if it
+ * was spilled to the heap), in which case only the requested size is usable
+ */
+size_t Pools_usable_size( struct Pools *self, void const *p );
+
+/**
+ * @brief Pools_find_pool_for_address Find the pool that owns a pointer. Only the owner thread may call this while a
+ * maintainer is attached, since the owner moves pools when it applies the maintainer's work.
+ * @param self                      Pointer to Pools struct
+ * @param p                         Pointer to check
+ * @return                          The Pool that p is an element of, or 0 if p was not allocated from any pool
+ */
+struct Pool *Pools_find_pool_for_address( struct Pools *self, void const *p );
+
+/**
+ * @brief Pools_owns_address        Check whether a pointer was allocated from one of the pools, from any thread. The layout
+ * is read the way Pools_deallocate_element reads it, so pools being inserted or removed meanwhile are seen consistently.
+ * @param self                      Pointer to Pools struct
+ * @param p                         Pointer to check
+ * @return                          1 if p is an element of one of the pools, 0 otherwise
+ */
+int Pools_owns_address( struct Pools *self, void const *p );
+
+/**
+ * @brief Pools_for_each_allocated  Call a function for each allocated element of every pool, pool by pool. Items spilled
+ * to the heap are not visited. When called by the owner thread the remote free list is drained first so that elements
+ * already freed by other threads are not reported; other threads are given copies of the pools. The callback may pass
+ * the element to Pools_deallocate_element.
+ * @param self                      Pointer to Pools struct
+ * @param callback                  The function to call with the context, the Pool and the element; a non zero return
+ * stops the walk
+ * @param context                   Passed through to the callback
+ * @return                          The number of elements the callback was called for
+ */
+size_t Pools_for_each_allocated( struct Pools *self,
+                                 int ( *callback )( void *context, struct Pool *pool, void *element ),
+                                 void *context );
+
+/**
+ * @brief Pools_trace_start         Start recording every allocation and deallocation into a memory mapped ring file that
+ * can be replayed offline with tools/pools_replay
+ * @param self                      Pointer to Pools struct
+ * @param path                      The path of the trace file to create
+ * @param capacity                  The number of records in the ring; older records are overwritten once it is full
+ * @return                          -1 on error, 0 on success
+ */
+int Pools_trace_start( struct Pools *self, const char *path, size_t capacity );
+
+/**
+ * @brief Pools_trace_stop          Stop recording and unmap the trace file. No other thread may be using the Pools.
+ * @param self                      Pointer to Pools struct
+ */
+void Pools_trace_stop( struct Pools *self );
+
+/**
+ * @brief Pools_profile_start       Start sampling about one allocation per sample_interval bytes, attributing each sample
+ * to its call stack and size class. Report with Pools_profile_report( &self->profile, ... ). Must be called by the owner
+ * thread; while sampling, remote frees of heap spills are also deferred to the owner so that they are accounted for.
+ * @param self                      Pointer to Pools struct
+ * @param sample_interval           The mean number of bytes allocated between samples
+ * @param max_sites                 The maximum number of distinct call sites and size classes
+ * @param max_live                  The maximum number of sampled allocations tracked until deallocation
+ * @return                          -1 on error, 0 on success
+ */
+int Pools_profile_start( struct Pools *self, size_t sample_interval, size_t max_sites, size_t max_live );
+
+/**
+ * @brief Pools_profile_stop        Stop sampling and discard the profile. No other thread may be using the Pools.
+ * @param self                      Pointer to Pools struct
+ */
+void Pools_profile_stop( struct Pools *self );
+
+/**
+ * @brief Pools_drain_remote_frees  Return all elements on the remote free list to their pools. Called automatically by
+ * Pools_allocate_element; must only be called by the owner thread.
+ * @param self                      Pointer to Pools struct
+ * @return                          The number of elements that were returned to their pools
+ */
+size_t Pools_drain_remote_frees( struct Pools *self );
+
 #if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
 /**
  * @brief Pools_diagnostics          Print pool diagnostics counters
@@ -0,0 +1,182 @@
+#ifndef pools_epoch_h
+#define pools_epoch_h
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Pools;
+
+/**
+ * @brief POOLS_EPOCH_RECLAIM_INTERVAL The number of retires after which a thread tries to advance the epoch and reclaim
+ */
+#define POOLS_EPOCH_RECLAIM_INTERVAL ( 64 )
+
+/**
+ * @brief Pools_epoch_bag The items one thread retired during one epoch. The items themselves are never written to, since
+ * readers may still be looking at them.
+ */
+struct Pools_epoch_bag
+{
+    void **items;
+    size_t count;
+    size_t capacity;
+
+    /**
+     * @brief epoch The global epoch the items were retired in
+     */
+    uint64_t epoch;
+};
+
+/**
+ * @brief Pools_epoch_thread The epoch state of one thread. Obtained with Pools_epoch_register and used only by that thread.
+ */
+struct Pools_epoch_thread
+{
+    /**
+     * @brief next The next record in the registry of the Pools. Records are never unlinked until Pools_terminate.
+     */
+    struct Pools_epoch_thread *next;
+
+    /**
+     * @brief state The epoch the thread is reading in, shifted left by one, with bit 0 set while it is inside a critical
+     * section. Read by other threads when they try to advance the epoch.
+     */
+    uint64_t state;
+
+    /**
+     * @brief in_use Set while a thread has the record registered
+     */
+    int in_use;
+
+    /**
+     * @brief nesting The depth of nested Pools_epoch_enter calls
+     */
+    unsigned nesting;
+
+    /**
+     * @brief retires_since_reclaim The number of items retired since the last reclaim attempt
+     */
+    size_t retires_since_reclaim;
+
+    /**
+     * @brief bag The retired items of the last three epochs, indexed by epoch modulo 3
+     */
+    struct Pools_epoch_bag bag[3];
+};
+
+struct Pools_epoch
+{
+    /**
+     * @brief global_epoch The current epoch. It advances once every thread inside a critical section has seen it.
+     */
+    uint64_t global_epoch;
+
+    /**
+     * @brief threads The lock-free registry of thread records
+     */
+    struct Pools_epoch_thread *threads;
+
+    /**
+     * @brief diag_num_retired Diagnostics counter for the number of items retired
+     */
+    size_t diag_num_retired;
+
+    /**
+     * @brief diag_num_reclaimed Diagnostics counter for the number of retired items returned to the Pools
+     */
+    size_t diag_num_reclaimed;
+
+    /**
+     * @brief diag_num_advances Diagnostics counter for the number of times the epoch advanced
+     */
+    size_t diag_num_advances;
+};
+
+/**
+ * @brief Pools_epoch_register      Get an epoch record for the calling thread, reusing one that another thread released
+ *                                  along with any items it still holds. Safe to call from any thread, as long as the low
+ *                                  level allocation function of the Pools is thread safe, since a new record comes from it.
+ * @param self                      Pointer to Pools struct
+ * @return                          The thread's record, or 0 if it could not be allocated
+ */
+struct Pools_epoch_thread *Pools_epoch_register( struct Pools *self );
+
+/**
+ * @brief Pools_epoch_unregister    Release a thread's epoch record, for instance before the thread exits. Items that cannot
+ *                                  be reclaimed yet stay with the record for the next thread that registers, or until
+ *                                  Pools_terminate.
+ * @param self                      Pointer to Pools struct
+ * @param thread                    The record returned by Pools_epoch_register, not inside a critical section
+ */
+void Pools_epoch_unregister( struct Pools *self, struct Pools_epoch_thread *thread );
+
+/**
+ * @brief Pools_epoch_enter         Begin a read side critical section. Items reached from shared data inside the section
+ *                                  stay valid until the matching Pools_epoch_exit even if another thread retires them.
+ *                                  Sections may nest.
+ * @param self                      Pointer to Pools struct
+ * @param thread                    The calling thread's record
+ */
+void Pools_epoch_enter( struct Pools *self, struct Pools_epoch_thread *thread );
+
+/**
+ * @brief Pools_epoch_exit          End a read side critical section
+ * @param self                      Pointer to Pools struct
+ * @param thread                    The calling thread's record
+ */
+void Pools_epoch_exit( struct Pools *self, struct Pools_epoch_thread *thread );
+
+/**
+ * @brief Pools_retire              Deallocate an item that has been unlinked from shared data once no reader can still be
+ *                                  looking at it. Items are batched per thread and returned with Pools_deallocate_element
+ *                                  two epochs later. The batches are grown and freed on the calling thread with the low
+ *                                  level functions of the Pools, which must therefore be thread safe.
+ * @param self                      Pointer to Pools struct
+ * @param thread                    The calling thread's record
+ * @param p                         The item to retire
+ * @return                          -1 if the batch could not be grown, in which case p was not retired, 0 on success
+ */
+int Pools_retire( struct Pools *self, struct Pools_epoch_thread *thread, void *p );
+
+/**
+ * @brief Pools_epoch_reclaim       Try to advance the epoch and return the calling thread's items that are old enough
+ * @param self                      Pointer to Pools struct
+ * @param thread                    The calling thread's record
+ * @return                          The number of items returned to the Pools
+ */
+size_t Pools_epoch_reclaim( struct Pools *self, struct Pools_epoch_thread *thread );
+
+/**
+ * @brief Pools_epoch_terminate     Return every retired item and free all thread records. Called by Pools_terminate; no
+ *                                  other thread may be using the Pools.
+ * @param self                      Pointer to Pools struct
+ */
+void Pools_epoch_terminate( struct Pools *self );
+
+#endif
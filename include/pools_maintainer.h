@@ -0,0 +1,274 @@
+#ifndef pools_maintainer_h
+#define pools_maintainer_h
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <pthread.h>
+#include "pools.h"
+
+#define POOLS_MAINTAINER_MAX_CALLBACKS ( 8 )
+
+#define POOLS_MAINTAINER_MAX_RETIRED ( 2 * POOLS_MAX_POOLS )
+
+/**
+ * @brief PoolsMaintainer_low_memory_callback A function to call when memory runs low, with the context it was registered
+ * with
+ */
+struct PoolsMaintainer_low_memory_callback
+{
+    void ( *callback )( void *context, struct Pools *pools );
+    void *context;
+};
+
+struct PoolsMaintainer
+{
+    /**
+     * @brief pools The Pools being maintained
+     */
+    struct Pools *pools;
+
+    /**
+     * @brief lock Guards the maintainer's own state and the work handed to the owner. The owner only ever tries it, so an
+     * allocation never waits for the maintainer. New element storage is allocated, and every page of it written once, outside
+     * the lock.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * @brief work_pending Set while there are ready pools or trim requests for the owner to apply
+     */
+    int work_pending;
+
+    /**
+     * @brief wakeup Signalled to stop the maintenance thread or to handle a low memory notification early
+     */
+    pthread_cond_t wakeup;
+
+    /**
+     * @brief thread The maintenance thread, valid while running is set
+     */
+    pthread_t thread;
+
+    /**
+     * @brief running Set while the maintenance thread exists
+     */
+    int running;
+
+    /**
+     * @brief stop_requested Set under lock to ask the maintenance thread to exit
+     */
+    int stop_requested;
+
+    /**
+     * @brief low_memory_pending Set by PoolsMaintainer_notify_low_memory or by a failed grow, cleared by the next pass
+     */
+    int low_memory_pending;
+
+    /**
+     * @brief interval_ms The time between maintenance passes of the thread
+     */
+    unsigned interval_ms;
+
+    /**
+     * @brief grow_watermark_percent A size class is grown by another pool once this percentage of its elements are
+     * allocated
+     */
+    unsigned grow_watermark_percent;
+
+    /**
+     * @brief trim_idle_passes A grown pool is released once it has had no allocated elements for this many passes
+     */
+    unsigned trim_idle_passes;
+
+    /**
+     * @brief num_grown The number of pools that were added by the maintainer and may be trimmed again
+     */
+    size_t num_grown;
+
+    /**
+     * @brief grown_storage The element storage of each grown pool, which identifies it while pools move in the array
+     */
+    unsigned char *grown_storage[POOLS_MAX_POOLS];
+
+    /**
+     * @brief grown_idle_passes The number of consecutive passes each grown pool has been empty
+     */
+    unsigned grown_idle_passes[POOLS_MAX_POOLS];
+
+    /**
+     * @brief num_ready The number of grown pools waiting to be inserted by the owner
+     */
+    size_t num_ready;
+
+    /**
+     * @brief ready_pool The pools initialized by the maintainer, waiting to be inserted by the owner
+     */
+    struct Pool ready_pool[POOLS_MAX_POOLS];
+
+    /**
+     * @brief num_trim_requests The number of grown pools waiting to be removed by the owner
+     */
+    size_t num_trim_requests;
+
+    /**
+     * @brief trim_request The element storage of each grown pool that the maintainer found idle. The owner removes it only
+     * if it is still empty.
+     */
+    unsigned char *trim_request[POOLS_MAX_POOLS];
+
+    /**
+     * @brief num_retired The number of pools removed by the owner, or grown but never inserted, waiting to be terminated
+     */
+    size_t num_retired;
+
+    /**
+     * @brief retired_pool The pools waiting to be terminated once no other thread is looking up pools. While it is full
+     * the owner leaves ready pools and trim requests pending rather than retire more.
+     */
+    struct Pool retired_pool[POOLS_MAINTAINER_MAX_RETIRED];
+
+    /**
+     * @brief num_low_memory_callbacks The number of registered low memory callbacks
+     */
+    size_t num_low_memory_callbacks;
+
+    /**
+     * @brief low_memory_callback The registered low memory callbacks, called from the maintenance pass in order
+     */
+    struct PoolsMaintainer_low_memory_callback low_memory_callback[POOLS_MAINTAINER_MAX_CALLBACKS];
+
+    /**
+     * @brief diag_num_passes Diagnostics counter for the number of maintenance passes
+     */
+    size_t diag_num_passes;
+
+    /**
+     * @brief diag_num_grows Diagnostics counter for the number of pools added ahead of demand
+     */
+    size_t diag_num_grows;
+
+    /**
+     * @brief diag_num_grow_failures Diagnostics counter for grows that failed for lack of memory or of pool slots
+     */
+    size_t diag_num_grow_failures;
+
+    /**
+     * @brief diag_num_trims Diagnostics counter for the number of idle grown pools released
+     */
+    size_t diag_num_trims;
+
+    /**
+     * @brief diag_num_low_memory_events Diagnostics counter for the number of times the low memory callbacks were run
+     */
+    size_t diag_num_low_memory_events;
+};
+
+/**
+ * @brief PoolsMaintainer_init          Attach a maintainer to a Pools, so that it may be grown and trimmed while it is in
+ *                                      use. The maintainer prepares new pools and picks idle ones, and the owner puts
+ *                                      the changes in place between its own allocations. No other thread may be using
+ *                                      the Pools during this call.
+ * @param self                          Pointer to PoolsMaintainer struct to initialize
+ * @param pools                         The Pools to maintain, with its initial pools already added
+ * @param interval_ms                   The time between maintenance passes of the thread
+ * @param grow_watermark_percent        Grow a size class once this percentage of its elements are allocated
+ * @param trim_idle_passes              Release a grown pool after it has been empty for this many passes
+ * @return                              -1 on error, 0 on success
+ */
+int PoolsMaintainer_init( struct PoolsMaintainer *self,
+                          struct Pools *pools,
+                          unsigned interval_ms,
+                          unsigned grow_watermark_percent,
+                          unsigned trim_idle_passes );
+
+/**
+ * @brief PoolsMaintainer_terminate     Stop the maintenance thread and detach from the Pools. Grown pools stay in the Pools
+ *                                      and are released by Pools_terminate. No other thread may be using the Pools.
+ * @param self                          Pointer to PoolsMaintainer struct
+ */
+void PoolsMaintainer_terminate( struct PoolsMaintainer *self );
+
+/**
+ * @brief PoolsMaintainer_start         Start the maintenance thread
+ * @param self                          Pointer to PoolsMaintainer struct
+ * @return                              -1 on error, 0 on success
+ */
+int PoolsMaintainer_start( struct PoolsMaintainer *self );
+
+/**
+ * @brief PoolsMaintainer_stop          Stop the maintenance thread and wait for it to exit
+ * @param self                          Pointer to PoolsMaintainer struct
+ */
+void PoolsMaintainer_stop( struct PoolsMaintainer *self );
+
+/**
+ * @brief PoolsMaintainer_run_once      Run one maintenance pass on the calling thread: grow size classes above the
+ *                                      watermark, release idle grown pools, and run the low memory callbacks if memory is
+ *                                      low. When called by the owner thread the changes are applied before it returns.
+ * @param self                          Pointer to PoolsMaintainer struct
+ */
+void PoolsMaintainer_run_once( struct PoolsMaintainer *self );
+
+/**
+ * @brief PoolsMaintainer_apply         Insert the pools grown and remove the pools trimmed since the last call. Must be
+ *                                      called by the owner thread; Pools_allocate_element calls it whenever work is
+ *                                      pending. Never waits: if the maintainer is busy the work stays pending.
+ * @param self                          Pointer to PoolsMaintainer struct
+ */
+void PoolsMaintainer_apply( struct PoolsMaintainer *self );
+
+/**
+ * @brief PoolsMaintainer_add_low_memory_callback Register a function to be called from the maintenance pass when memory
+ *                                      runs low, after idle grown pools have been released
+ * @param self                          Pointer to PoolsMaintainer struct
+ * @param callback                      The function to call with the context and the Pools
+ * @param context                       Passed through to the callback
+ * @return                              -1 if there are already POOLS_MAINTAINER_MAX_CALLBACKS callbacks, 0 on success
+ */
+int PoolsMaintainer_add_low_memory_callback( struct PoolsMaintainer *self,
+                                             void ( *callback )( void *context, struct Pools *pools ),
+                                             void *context );
+
+/**
+ * @brief PoolsMaintainer_notify_low_memory Report memory pressure, for instance from a cgroup or PSI monitor. Safe to
+ *                                      call from any thread; the next pass releases every idle grown pool and runs the
+ *                                      low memory callbacks.
+ * @param self                          Pointer to PoolsMaintainer struct
+ */
+void PoolsMaintainer_notify_low_memory( struct PoolsMaintainer *self );
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+/**
+ * @brief PoolsMaintainer_diagnostics   Print the maintainer diagnostics counters
+ * @param self                          Pointer to PoolsMaintainer struct to diagnose
+ * @param prefix                        Pointer to cstring which will be put in front of each line outputted
+ * @param print                         Pointer to function to be called for each line of text
+ */
+void PoolsMaintainer_diagnostics( struct PoolsMaintainer *self, const char *prefix, int ( *print )( const char * ) );
+#endif
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef pools_numa_h
+#define pools_numa_h
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <pthread.h>
+#include "pools.h"
+
+#define POOLS_NUMA_MAX_NODES ( 8 )
+
+#define POOLS_NUMA_MAX_THREADS ( 64 )
+
+/**
+ * @brief PoolsNuma_thread_state The life cycle of each of the per thread Pools of a PoolsNuma
+ */
+enum PoolsNuma_thread_state
+{
+    /**
+     * @brief POOLS_NUMA_THREAD_UNUSED The slot has never been used
+     */
+    POOLS_NUMA_THREAD_UNUSED = 0,
+
+    /**
+     * @brief POOLS_NUMA_THREAD_CLAIMED A thread is initializing the Pools; other threads do not look at it yet
+     */
+    POOLS_NUMA_THREAD_CLAIMED,
+
+    /**
+     * @brief POOLS_NUMA_THREAD_ATTACHED The Pools is owned by an attached thread
+     */
+    POOLS_NUMA_THREAD_ATTACHED,
+
+    /**
+     * @brief POOLS_NUMA_THREAD_DETACHED The thread detached. Frees still reach the Pools through its remote free list, and
+     * the next thread to attach on the same node takes it over.
+     */
+    POOLS_NUMA_THREAD_DETACHED
+};
+
+struct PoolsNuma
+{
+    /**
+     * @brief num_nodes The number of NUMA nodes that have their own Pools. 1 on single node machines.
+     */
+    size_t num_nodes;
+
+    /**
+     * @brief node One Pools per NUMA node, with element storage bound to that node
+     */
+    struct Pools node[POOLS_NUMA_MAX_NODES];
+
+    /**
+     * @brief node_lock Serializes allocation and deallocation on each node's Pools, since many threads share a node. Only
+     * threads that are not attached take it on their allocations.
+     */
+    pthread_mutex_t node_lock[POOLS_NUMA_MAX_NODES];
+
+    /**
+     * @brief num_classes The number of pools added with PoolsNuma_add, which are added to each attached thread's Pools
+     */
+    size_t num_classes;
+
+    /**
+     * @brief class_element_size The element size of each pool added with PoolsNuma_add
+     */
+    size_t class_element_size[POOLS_MAX_POOLS];
+
+    /**
+     * @brief class_number_of_elements The number of elements of each pool added with PoolsNuma_add
+     */
+    size_t class_number_of_elements[POOLS_MAX_POOLS];
+
+    /**
+     * @brief num_thread_slots One more than the highest thread_pools slot ever claimed, which bounds the lookups of frees
+     */
+    size_t num_thread_slots;
+
+    /**
+     * @brief thread_state The enum PoolsNuma_thread_state of each slot of thread_pools
+     */
+    int thread_state[POOLS_NUMA_MAX_THREADS];
+
+    /**
+     * @brief thread_pools The Pools of each attached thread, on the node the thread attached on. Each is owned by its thread
+     * and used without any lock.
+     */
+    struct Pools thread_pools[POOLS_NUMA_MAX_THREADS];
+
+    /**
+     * @brief diag_num_bind_failures Diagnostics counter of the number of pools whose storage could not be bound to their node
+     */
+    size_t diag_num_bind_failures;
+
+    /**
+     * @brief name The name of this collection of per node Pools
+     */
+    const char *name;
+};
+
+/**
+ * @brief PoolsNuma_init                Initialize a PoolsNuma structure with one empty Pools per online NUMA node
+ * @param self                          Pointer to PoolsNuma struct to init
+ * @param name                          Pointer to string of name of this collection of pools
+ * @param low_level_allocation_function Pointer to low level memory allocation function
+ * @param low_level_free_function       Pointer to low level memory free function, which must be thread safe
+ * @return                              -1 on error, 0 on success
+ */
+int PoolsNuma_init( struct PoolsNuma *self,
+                    const char *name,
+                    void *( *low_level_allocation_function )( size_t ),
+                    void ( *low_level_free_function )( void * ) );
+
+/**
+ * @brief PoolsNuma_add                 Add a pool of the given element size to every node, and to the Pools of every
+ *                                      thread that attaches afterwards, binding the element storage to its node with
+ *                                      mbind before it is first written. Binding failures are counted but not fatal.
+ * @param self                          Pointer to PoolsNuma struct
+ * @param element_size                  The size of the element for the new pools
+ * @param number_of_elements            The number of elements per node
+ * @return                              -1 on error, 0 on success
+ */
+int PoolsNuma_add( struct PoolsNuma *self, size_t element_size, size_t number_of_elements );
+
+/**
+ * @brief PoolsNuma_terminate       Terminate every node's Pools and every thread's Pools. No thread may be using the
+ *                                  PoolsNuma any more.
+ * @param self                      Pointer to the PoolsNuma to terminate
+ */
+void PoolsNuma_terminate( struct PoolsNuma *self );
+
+/**
+ * @brief PoolsNuma_attach_thread   Give the calling thread a Pools of its own on the node it is running on, with a pool of
+ *                                  every size added so far, so that its allocations take no lock. A Pools left by a
+ *                                  thread that detached on the same node is taken over before a new one is made. The
+ *                                  thread must call PoolsNuma_detach_thread before it exits.
+ * @param self                      Pointer to PoolsNuma struct
+ * @return                          -1 if all POOLS_NUMA_MAX_THREADS Pools are attached, a pool could not be added or the
+ *                                  thread is attached to another PoolsNuma, 0 on success or if the thread was already
+ *                                  attached
+ */
+int PoolsNuma_attach_thread( struct PoolsNuma *self );
+
+/**
+ * @brief PoolsNuma_detach_thread   Give up the calling thread's Pools. Items still allocated from it stay valid and may be
+ *                                  freed from any thread until the next thread on the node takes it over.
+ * @param self                      Pointer to PoolsNuma struct
+ */
+void PoolsNuma_detach_thread( struct PoolsNuma *self );
+
+/**
+ * @brief PoolsNuma_thread_pools    Get the Pools of the calling thread
+ * @param self                      Pointer to PoolsNuma struct
+ * @return                          The Pools the calling thread attached to, or 0 if it is not attached
+ */
+struct Pools *PoolsNuma_thread_pools( struct PoolsNuma *self );
+
+/**
+ * @brief PoolsNuma_allocate_element Allocate from the calling thread's own Pools if it is attached, without a lock, or
+ *                                  else from the shared Pools of the NUMA node it is running on under that node's lock.
+ *                                  The lock is taken and released on every call, so threads that allocate often should
+ *                                  attach; see tools-dev/pools_numa_bench.c for the difference.
+ * @param self                      Pointer to PoolsNuma struct
+ * @param size                      Size of the item to allocate
+ * @return                          pointer to allocated item, or 0 on error
+ */
+void *PoolsNuma_allocate_element( struct PoolsNuma *self, size_t size );
+
+/**
+ * @brief PoolsNuma_deallocate_element Return an item to the Pools that owns its storage, from any thread. Items of a thread's
+ *                                  own Pools are returned without a lock, through its remote free list if another
+ *                                  thread frees them; items of a node's shared Pools are returned under the node's lock.
+ * @param self                      Pointer to PoolsNuma struct
+ * @param p                         Pointer to allocated item
+ */
+void PoolsNuma_deallocate_element( struct PoolsNuma *self, void *p );
+
+/**
+ * @brief PoolsNuma_current_node    Get the NUMA node of the CPU the calling thread is running on
+ * @param self                      Pointer to PoolsNuma struct
+ * @return                          The node index, always less than self->num_nodes
+ */
+size_t PoolsNuma_current_node( struct PoolsNuma *self );
+
+/**
+ * @brief Pool_bind_to_numa_node    Bind the whole pages of a pool's element storage to a NUMA node, migrating pages that
+ *                                  are already resident
+ * @param self                      The Pool to bind
+ * @param node                      The NUMA node to bind to
+ * @return                          -1 if binding is unsupported or failed, 0 on success
+ */
+int Pool_bind_to_numa_node( struct Pool *self, int node );
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+/**
+ * @brief PoolsNuma_diagnostics      Print the diagnostics and occupancy of every node's Pools and every thread's Pools.
+ * The threads' Pools are read without a lock, so their threads should be idle.
+ * @param self                      Pointer to PoolsNuma struct to diagnose
+ * @param prefix                    Pointer to cstring which will be put in front of each line outputted
+ * @param print                     Pointer to function to be called for each line of text
+ */
+void PoolsNuma_diagnostics( struct PoolsNuma *self, const char *prefix, int ( *print )( const char * ) );
+#endif
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef pools_profile_h
+#define pools_profile_h
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief POOLS_PROFILE_MAX_FRAMES The maximum number of return addresses kept for each call site
+ */
+#define POOLS_PROFILE_MAX_FRAMES ( 16 )
+
+/**
+ * @brief Pools_profile_site The sampled allocations of one size class from one call stack
+ */
+struct Pools_profile_site
+{
+    /**
+     * @brief frames The return addresses of the call stack, innermost first
+     */
+    void *frames[POOLS_PROFILE_MAX_FRAMES];
+
+    /**
+     * @brief depth The number of valid entries in frames; 0 marks an unused site
+     */
+    size_t depth;
+
+    /**
+     * @brief class_size The element_size of the pool the allocations came from, or 0 for spills to the heap
+     */
+    size_t class_size;
+
+    /**
+     * @brief total_samples The number of sampled allocations
+     */
+    size_t total_samples;
+
+    /**
+     * @brief total_bytes The estimated number of bytes allocated, scaled up from the samples
+     */
+    size_t total_bytes;
+
+    /**
+     * @brief live_samples The number of sampled allocations that have not been deallocated
+     */
+    size_t live_samples;
+
+    /**
+     * @brief live_bytes The estimated number of bytes still allocated, scaled up from the samples
+     */
+    size_t live_bytes;
+};
+
+/**
+ * @brief Pools_profile_live A sampled allocation that has not been deallocated yet
+ */
+struct Pools_profile_live
+{
+    /**
+     * @brief p The sampled item; 0 marks an unused slot
+     */
+    void const *p;
+
+    /**
+     * @brief site The index of the site that the sample was attributed to
+     */
+    size_t site;
+
+    /**
+     * @brief bytes The estimated number of bytes that the sample stands for
+     */
+    size_t bytes;
+};
+
+struct Pools_profile
+{
+    /**
+     * @brief sites The open addressed table of call sites; profiling is enabled while sites is not 0
+     */
+    struct Pools_profile_site *sites;
+
+    /**
+     * @brief site_mask The number of entries in sites minus one
+     */
+    size_t site_mask;
+
+    /**
+     * @brief num_sites The number of used entries in sites
+     */
+    size_t num_sites;
+
+    /**
+     * @brief live The open addressed table of sampled allocations that are still allocated
+     */
+    struct Pools_profile_live *live;
+
+    /**
+     * @brief live_mask The number of entries in live minus one
+     */
+    size_t live_mask;
+
+    /**
+     * @brief num_live The number of used entries in live
+     */
+    size_t num_live;
+
+    /**
+     * @brief sample_interval The mean number of bytes allocated between samples
+     */
+    size_t sample_interval;
+
+    /**
+     * @brief bytes_until_sample The countdown of bytes until the next sample is taken
+     */
+    ptrdiff_t bytes_until_sample;
+
+    /**
+     * @brief random_state The xorshift state used to jitter the sampling interval
+     */
+    uint64_t random_state;
+
+    /**
+     * @brief mapping_size The size in bytes of the anonymous mapping holding sites and live
+     */
+    size_t mapping_size;
+
+    /**
+     * @brief diag_num_samples Diagnostics counter for the number of samples taken
+     */
+    size_t diag_num_samples;
+
+    /**
+     * @brief diag_num_dropped_samples Diagnostics counter for the number of samples that did not fit in the tables
+     */
+    size_t diag_num_dropped_samples;
+};
+
+/**
+ * @brief Pools_profile_open            Allocate the profile tables and start the sampling countdown. The tables are
+ *                                      mapped directly from the kernel so that profiling never allocates from the heap
+ *                                      that is being profiled.
+ * @param self                          Pointer to Pools_profile struct to initialize
+ * @param sample_interval               The mean number of bytes allocated between samples
+ * @param max_sites                     The maximum number of distinct call sites and size classes
+ * @param max_live                      The maximum number of sampled allocations that are tracked until deallocation
+ * @return                              -1 on error, 0 on success
+ */
+int Pools_profile_open( struct Pools_profile *self, size_t sample_interval, size_t max_sites, size_t max_live );
+
+/**
+ * @brief Pools_profile_close           Release the profile tables. The profile is then disabled.
+ * @param self                          Pointer to Pools_profile struct
+ */
+void Pools_profile_close( struct Pools_profile *self );
+
+/**
+ * @brief Pools_profile_record_allocation Capture the call stack of an allocation that exhausted the sampling countdown,
+ *                                      and restart the countdown
+ * @param self                          Pointer to Pools_profile struct
+ * @param class_size                    The element_size of the pool that satisfied the allocation, or 0 for the heap
+ * @param p                             The item
+ */
+void Pools_profile_record_allocation( struct Pools_profile *self, size_t class_size, void const *p );
+
+/**
+ * @brief Pools_profile_record_deallocation Remove an item from the live totals if it was sampled
+ * @param self                          Pointer to Pools_profile struct
+ * @param p                             The item
+ */
+void Pools_profile_record_deallocation( struct Pools_profile *self, void const *p );
+
+/**
+ * @brief Pools_profile_report          Print one line per call site in the folded stack format read by flamegraph.pl and
+ *                                      pprof: the size class, then the call stack outermost first separated by ';', then a
+ *                                      space and the estimated number of bytes
+ * @param self                          Pointer to Pools_profile struct
+ * @param live                          Non zero to report bytes still allocated, zero to report all bytes ever allocated
+ * @param print                         Pointer to function to be called for each line of text
+ */
+void Pools_profile_report( struct Pools_profile *self, int live, int ( *print )( const char * ) );
+
+#endif
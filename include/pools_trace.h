@@ -0,0 +1,144 @@
+#ifndef pools_trace_h
+#define pools_trace_h
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief POOLS_TRACE_MAGIC The first 8 bytes of a trace file, "PLSTRCE1" in little endian
+ */
+#define POOLS_TRACE_MAGIC ( 0x3145435254534c50ULL )
+
+#define POOLS_TRACE_ALLOCATE ( 1 )
+#define POOLS_TRACE_DEALLOCATE ( 2 )
+
+/**
+ * @brief Pools_trace_header The header at the start of a trace file, followed by capacity Pools_trace_record structs used
+ * as a ring
+ */
+struct Pools_trace_header
+{
+    /**
+     * @brief magic POOLS_TRACE_MAGIC
+     */
+    uint64_t magic;
+
+    /**
+     * @brief capacity The number of records in the ring
+     */
+    uint64_t capacity;
+
+    /**
+     * @brief head The total number of records ever written. Record n is stored at index n % capacity, so once head exceeds
+     * capacity the oldest surviving record is at head % capacity.
+     */
+    uint64_t head;
+
+    /**
+     * @brief start_ns The CLOCK_MONOTONIC time in nanoseconds that timestamps are relative to
+     */
+    uint64_t start_ns;
+};
+
+/**
+ * @brief Pools_trace_record One allocation or deallocation
+ */
+struct Pools_trace_record
+{
+    /**
+     * @brief timestamp_ns Nanoseconds since the trace was started
+     */
+    uint64_t timestamp_ns;
+
+    /**
+     * @brief object_id The address of the item, which identifies it from its allocation to its deallocation
+     */
+    uint64_t object_id;
+
+    /**
+     * @brief size The requested size for allocations, saturated at UINT32_MAX; 0 for deallocations
+     */
+    uint32_t size;
+
+    /**
+     * @brief thread A small number identifying the calling thread, assigned in order of first trace use
+     */
+    uint16_t thread;
+
+    /**
+     * @brief op POOLS_TRACE_ALLOCATE or POOLS_TRACE_DEALLOCATE
+     */
+    uint8_t op;
+
+    uint8_t reserved;
+};
+
+struct Pools_trace
+{
+    /**
+     * @brief header The memory mapped header of the trace file
+     */
+    struct Pools_trace_header *header;
+
+    /**
+     * @brief records The memory mapped ring of records that follows the header
+     */
+    struct Pools_trace_record *records;
+
+    /**
+     * @brief mapping_size The size in bytes of the mapping of the trace file
+     */
+    size_t mapping_size;
+};
+
+/**
+ * @brief Pools_trace_open              Create a trace file of a fixed size and map it into memory
+ * @param self                          Pointer to Pools_trace struct to initialize
+ * @param path                          The path of the trace file, which is truncated if it exists
+ * @param capacity                      The number of records in the ring
+ * @return                              -1 on error, 0 on success
+ */
+int Pools_trace_open( struct Pools_trace *self, const char *path, size_t capacity );
+
+/**
+ * @brief Pools_trace_close             Unmap a trace file. The records written so far remain in the file.
+ * @param self                          Pointer to Pools_trace struct
+ */
+void Pools_trace_close( struct Pools_trace *self );
+
+/**
+ * @brief Pools_trace_record            Append a record to the ring. Safe to call from any thread.
+ * @param self                          Pointer to Pools_trace struct
+ * @param op                            POOLS_TRACE_ALLOCATE or POOLS_TRACE_DEALLOCATE
+ * @param size                          The requested size
+ * @param p                             The item
+ */
+void Pools_trace_record( struct Pools_trace *self, int op, size_t size, void const *p );
+
+#endif
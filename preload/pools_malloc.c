@@ -0,0 +1,277 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * libpools_malloc.so: an LD_PRELOAD interposer that serves small allocations of unmodified programs from a process wide
+ * Pools and forwards everything else to the glibc allocator.
+ *
+ * POOLS_MALLOC              comma separated list of element_size:num_elements classes, for example "64:4096,256:1024".
+ *                           Element sizes are rounded up to a multiple of POOLS_MALLOC_ALIGNMENT.
+ * POOLS_MALLOC_DIAGNOSTICS  if set to a non-zero value, Pools_diagnostics is printed to stderr at exit.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "pools.h"
+
+#define POOLS_MALLOC_ALIGNMENT ( 16 )
+#define POOLS_MALLOC_DEFAULT_CONFIG "16:8192,32:8192,64:4096,128:4096,256:2048,512:1024,1024:512"
+
+extern void *__libc_malloc( size_t );
+extern void __libc_free( void * );
+extern void *__libc_calloc( size_t, size_t );
+extern void *__libc_realloc( void *, size_t );
+extern void *__libc_memalign( size_t, size_t );
+
+static struct Pools pools_malloc_pools;
+static pthread_mutex_t pools_malloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pools_malloc_initialized = 0;
+static size_t pools_malloc_max_size = 0;
+static uintptr_t pools_malloc_lowest_address = UINTPTR_MAX;
+static uintptr_t pools_malloc_highest_address = 0;
+static int pools_malloc_diagnostics_fd = 2;
+
+static void pools_malloc_prefork( void ) { pthread_mutex_lock( &pools_malloc_lock ); }
+
+static void pools_malloc_postfork( void ) { pthread_mutex_unlock( &pools_malloc_lock ); }
+
+static int pools_malloc_print( const char *s )
+{
+    /* stdio may allocate, so write straight to the file descriptor */
+    ssize_t r = write( pools_malloc_diagnostics_fd, s, strlen( s ) );
+    r = write( pools_malloc_diagnostics_fd, "\n", 1 );
+    return (int)r;
+}
+
+static void pools_malloc_dump_diagnostics( void )
+{
+    pthread_mutex_lock( &pools_malloc_lock );
+    Pools_diagnostics( &pools_malloc_pools, "pools_malloc", pools_malloc_print );
+    pthread_mutex_unlock( &pools_malloc_lock );
+}
+
+static void pools_malloc_configure( const char *config )
+{
+    const char *s = config;
+    while ( *s )
+    {
+        char *end = 0;
+        size_t element_size = strtoul( s, &end, 10 );
+        size_t num_elements = 0;
+        if ( end == s || *end != ':' )
+        {
+            break;
+        }
+        s = end + 1;
+        num_elements = strtoul( s, &end, 10 );
+        if ( end == s )
+        {
+            break;
+        }
+        s = *end == ',' ? end + 1 : end;
+        element_size = ( element_size + POOLS_MALLOC_ALIGNMENT - 1 ) & ~(size_t)( POOLS_MALLOC_ALIGNMENT - 1 );
+        if ( element_size > 0 && num_elements > 0 && Pools_add( &pools_malloc_pools, element_size, num_elements ) == 0 )
+        {
+            struct Pool *pool = &pools_malloc_pools.pool[pools_malloc_pools.num_pools - 1];
+            uintptr_t base = (uintptr_t)pool->element_storage;
+            if ( element_size > pools_malloc_max_size )
+            {
+                pools_malloc_max_size = element_size;
+            }
+            if ( base < pools_malloc_lowest_address )
+            {
+                pools_malloc_lowest_address = base;
+            }
+            if ( base + pool->element_storage_size > pools_malloc_highest_address )
+            {
+                pools_malloc_highest_address = base + pool->element_storage_size;
+            }
+        }
+    }
+}
+
+static void pools_malloc_initialize( void )
+{
+    int first = 0;
+    pthread_mutex_lock( &pools_malloc_lock );
+    if ( !pools_malloc_initialized )
+    {
+        const char *config = getenv( "POOLS_MALLOC" );
+        pools_malloc_initialized = 1;
+        first = 1;
+        Pools_init( &pools_malloc_pools, "pools_malloc", __libc_malloc, __libc_free );
+        Pools_set_low_level_reallocation_function( &pools_malloc_pools, __libc_realloc );
+        /* large pool storage then comes straight from mmap, so pages no program touches are never faulted in */
+        Pools_set_low_level_zeroed_allocation_function( &pools_malloc_pools, __libc_calloc );
+        /* every call is serialized by pools_malloc_lock, so all frees take the local path */
+        pools_malloc_pools.owner_thread = 0;
+        pools_malloc_configure( config && *config ? config : POOLS_MALLOC_DEFAULT_CONFIG );
+    }
+    pthread_mutex_unlock( &pools_malloc_lock );
+    if ( first )
+    {
+        const char *diagnostics = getenv( "POOLS_MALLOC_DIAGNOSTICS" );
+        pthread_atfork( pools_malloc_prefork, pools_malloc_postfork, pools_malloc_postfork );
+        if ( diagnostics && *diagnostics && *diagnostics != '0' )
+        {
+            /* keep a private copy of stderr since many programs close their standard streams in their own exit handlers */
+            int fd = fcntl( 2, F_DUPFD_CLOEXEC, 3 );
+            if ( fd >= 0 )
+            {
+                pools_malloc_diagnostics_fd = fd;
+            }
+            atexit( pools_malloc_dump_diagnostics );
+        }
+    }
+}
+
+static int pools_malloc_is_pool_address( void const *p )
+{
+    uintptr_t a = (uintptr_t)p;
+    return a >= pools_malloc_lowest_address && a < pools_malloc_highest_address;
+}
+
+void *malloc( size_t size )
+{
+    void *r;
+    if ( !pools_malloc_initialized )
+    {
+        pools_malloc_initialize();
+    }
+    if ( size > pools_malloc_max_size )
+    {
+        return __libc_malloc( size );
+    }
+    pthread_mutex_lock( &pools_malloc_lock );
+    r = Pools_allocate_element( &pools_malloc_pools, size );
+    pthread_mutex_unlock( &pools_malloc_lock );
+    return r;
+}
+
+void free( void *p )
+{
+    if ( !pools_malloc_is_pool_address( p ) )
+    {
+        __libc_free( p );
+        return;
+    }
+    pthread_mutex_lock( &pools_malloc_lock );
+    Pools_deallocate_element( &pools_malloc_pools, p );
+    pthread_mutex_unlock( &pools_malloc_lock );
+}
+
+void *calloc( size_t nmemb, size_t size )
+{
+    void *r;
+    if ( size != 0 && nmemb > SIZE_MAX / size )
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+    if ( !pools_malloc_initialized )
+    {
+        pools_malloc_initialize();
+    }
+    if ( nmemb * size > pools_malloc_max_size )
+    {
+        return __libc_calloc( nmemb, size );
+    }
+    pthread_mutex_lock( &pools_malloc_lock );
+    r = Pools_allocate_zeroed( &pools_malloc_pools, nmemb * size );
+    pthread_mutex_unlock( &pools_malloc_lock );
+    return r;
+}
+
+void *realloc( void *p, size_t size )
+{
+    void *r;
+    if ( p == 0 )
+    {
+        return malloc( size );
+    }
+    if ( !pools_malloc_is_pool_address( p ) )
+    {
+        return __libc_realloc( p, size );
+    }
+    pthread_mutex_lock( &pools_malloc_lock );
+    r = Pools_reallocate( &pools_malloc_pools, p, Pools_usable_size( &pools_malloc_pools, p ), size );
+    pthread_mutex_unlock( &pools_malloc_lock );
+    return r;
+}
+
+int posix_memalign( void **memptr, size_t alignment, size_t size )
+{
+    void *r;
+    if ( alignment < sizeof( void * ) || ( alignment & ( alignment - 1 ) ) != 0 )
+    {
+        return EINVAL;
+    }
+    r = alignment <= POOLS_MALLOC_ALIGNMENT ? malloc( size ) : __libc_memalign( alignment, size );
+    if ( r == 0 )
+    {
+        return ENOMEM;
+    }
+    *memptr = r;
+    return 0;
+}
+
+void *aligned_alloc( size_t alignment, size_t size )
+{
+    if ( alignment == 0 || ( alignment & ( alignment - 1 ) ) != 0 )
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return alignment <= POOLS_MALLOC_ALIGNMENT ? malloc( size ) : __libc_memalign( alignment, size );
+}
+
+size_t malloc_usable_size( void *p )
+{
+    static size_t ( *libc_malloc_usable_size )( void * ) = 0;
+    if ( p == 0 )
+    {
+        return 0;
+    }
+    if ( pools_malloc_is_pool_address( p ) )
+    {
+        size_t usable = Pools_usable_size( &pools_malloc_pools, p );
+        if ( usable )
+        {
+            return usable;
+        }
+    }
+    if ( libc_malloc_usable_size == 0 )
+    {
+        libc_malloc_usable_size = ( size_t( * )( void * ) )dlsym( RTLD_NEXT, "malloc_usable_size" );
+    }
+    return libc_malloc_usable_size ? libc_malloc_usable_size( p ) : 0;
+}
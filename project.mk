@@ -13,4 +13,5 @@ CONFIG_TOOLS+=
 PKGCONFIG_PACKAGES+=
 
 CXXFLAGS+=
+LDLIBS+=-lpthread -lrt -ldl
 
@@ -27,19 +27,38 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "pool.h"
 
-int Pool_init( struct Pool *self,
-               size_t num_elements,
-               size_t element_size,
-               void *( *low_level_allocation_function )( size_t ),
-               void ( *low_level_free_function )( void * ) )
+static uint64_t Pool_calculate_inverse( uint64_t odd )
+{
+    /* Newton's iteration doubles the number of correct low bits each time; odd * odd == 1 mod 8 gives the first 3 */
+    uint64_t inverse = odd;
+    int i;
+    for ( i = 0; i < 5; ++i )
+    {
+        inverse *= 2 - odd * inverse;
+    }
+    return inverse;
+}
+
+size_t Pool_allocated_flags_size( size_t num_elements )
+{
+    /* one bit per element rounded up to whole words, then one summary bit per word, then one dirty bit and one remote free
+     * bit per element */
+    size_t num_flag_words = ( num_elements + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+    size_t num_summary_words = ( num_flag_words + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+    return ( 3 * num_flag_words + num_summary_words ) * sizeof( uint64_t );
+}
+
+void Pool_init_view( struct Pool *self,
+                     size_t num_elements,
+                     size_t element_size,
+                     uint64_t *allocated_flags,
+                     unsigned char *element_storage )
 {
-    int r = -1;
-    /* one bit per element */
-    size_t size_of_allocated_flags_in_bytes = ( num_elements + 7 ) / 8;
     memset( self, 0, sizeof( *self ) );
     self->element_size = element_size;
     self->num_elements = num_elements;
     self->next_available_hint = 0;
+    self->placement_policy = POOL_PLACEMENT_LIFO;
     self->diag_num_allocations = 0;
     self->diag_num_frees = 0;
     self->diag_num_spills = 0;
@@ -47,24 +66,93 @@ int Pool_init( struct Pool *self,
     self->diag_multiple_allocation_errors = 0;
     self->diag_multiple_deallocation_errors = 0;
     self->element_storage_size = num_elements * element_size;
+    if ( element_size > 0 )
+    {
+        self->element_size_shift = (unsigned int)__builtin_ctzll( element_size );
+        self->element_size_inverse = Pool_calculate_inverse( (uint64_t)( element_size >> self->element_size_shift ) );
+    }
+    self->allocated_flags = allocated_flags;
+    if ( allocated_flags )
+    {
+        size_t num_flag_words = ( num_elements + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+        self->full_flag_words = allocated_flags + num_flag_words;
+        self->dirty_flags = self->full_flag_words + ( num_flag_words + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+        self->remote_free_flags = self->dirty_flags + num_flag_words;
+    }
+    self->element_storage = element_storage;
+}
+
+void Pool_clear_allocated_flags( struct Pool *self )
+{
+    size_t num_flag_words = ( self->num_elements + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+    size_t num_summary_words = ( num_flag_words + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+    size_t num_padding_bits = num_flag_words * POOL_FLAGS_BITS_PER_WORD - self->num_elements;
+    size_t num_summary_padding_bits = num_summary_words * POOL_FLAGS_BITS_PER_WORD - num_flag_words;
+    memset( self->allocated_flags, 0, Pool_allocated_flags_size( self->num_elements ) );
+    /* the padding bits past the last element and the last flag word look allocated so that scans never return them */
+    if ( num_padding_bits > 0 )
+    {
+        self->allocated_flags[num_flag_words - 1] = ~( ~(uint64_t)0 >> num_padding_bits );
+    }
+    if ( num_summary_padding_bits > 0 )
+    {
+        self->full_flag_words[num_summary_words - 1] = ~( ~(uint64_t)0 >> num_summary_padding_bits );
+    }
+    self->total_allocated_items = 0;
+    self->next_available_hint = 0;
+    self->free_stack_top = 0;
+}
+
+static int Pool_init_storage( struct Pool *self,
+                              size_t num_elements,
+                              size_t element_size,
+                              void *( *low_level_allocation_function )( size_t ),
+                              void *( *low_level_zeroed_allocation_function )( size_t, size_t ),
+                              void ( *low_level_free_function )( void * ),
+                              void ( *place_storage )( void *context, struct Pool *pool ),
+                              void *context )
+{
+    int r = -1;
+    Pool_init_view( self, num_elements, element_size, 0, 0 );
     self->low_level_allocation_function = low_level_allocation_function;
     self->low_level_free_function = low_level_free_function;
 
-    if ( self->element_storage_size > 0 )
+    if ( element_size > 0 && self->element_storage_size / element_size != num_elements )
+    {
+        /* num_elements * element_size overflowed */
+        self->element_storage_size = 0;
+    }
+    else if ( self->element_storage_size > 0 )
     {
-        self->allocated_flags = (unsigned char *)low_level_allocation_function( size_of_allocated_flags_in_bytes );
-        if ( self->allocated_flags )
+        size_t flags_size = Pool_allocated_flags_size( num_elements );
+        uint64_t *allocated_flags = (uint64_t *)( low_level_zeroed_allocation_function
+                                                      ? low_level_zeroed_allocation_function( 1, flags_size )
+                                                      : low_level_allocation_function( flags_size ) );
+        if ( allocated_flags )
         {
-            memset( self->allocated_flags, 0, size_of_allocated_flags_in_bytes );
-            self->element_storage = (unsigned char *)low_level_allocation_function( self->element_storage_size );
-            if ( self->element_storage )
+            unsigned char *element_storage
+                = (unsigned char *)( low_level_zeroed_allocation_function
+                                         ? low_level_zeroed_allocation_function( num_elements, element_size )
+                                         : low_level_allocation_function( self->element_storage_size ) );
+            if ( element_storage )
             {
-                memset( self->element_storage, 0, self->element_storage_size );
+                Pool_init_view( self, num_elements, element_size, allocated_flags, element_storage );
+                self->low_level_allocation_function = low_level_allocation_function;
+                self->low_level_free_function = low_level_free_function;
+                if ( place_storage )
+                {
+                    place_storage( context, self );
+                }
+                Pool_clear_allocated_flags( self );
+                if ( !low_level_zeroed_allocation_function )
+                {
+                    memset( self->element_storage, 0, self->element_storage_size );
+                }
                 r = 0;
             }
             else
             {
-                low_level_free_function( self->allocated_flags );
+                low_level_free_function( allocated_flags );
             }
         }
     }
@@ -75,16 +163,70 @@ int Pool_init( struct Pool *self,
     return r;
 }
 
+int Pool_init( struct Pool *self,
+               size_t num_elements,
+               size_t element_size,
+               void *( *low_level_allocation_function )( size_t ),
+               void ( *low_level_free_function )( void * ) )
+{
+    return Pool_init_storage(
+        self, num_elements, element_size, low_level_allocation_function, 0, low_level_free_function, 0, 0 );
+}
+
+int Pool_init_zeroed( struct Pool *self,
+                      size_t num_elements,
+                      size_t element_size,
+                      void *( *low_level_zeroed_allocation_function )( size_t, size_t ),
+                      void ( *low_level_free_function )( void * ) )
+{
+    return Pool_init_storage(
+        self, num_elements, element_size, 0, low_level_zeroed_allocation_function, low_level_free_function, 0, 0 );
+}
+
+int Pool_init_placed( struct Pool *self,
+                      size_t num_elements,
+                      size_t element_size,
+                      void *( *low_level_allocation_function )( size_t ),
+                      void *( *low_level_zeroed_allocation_function )( size_t, size_t ),
+                      void ( *low_level_free_function )( void * ),
+                      void ( *place_storage )( void *context, struct Pool *pool ),
+                      void *context )
+{
+    return Pool_init_storage( self,
+                              num_elements,
+                              element_size,
+                              low_level_allocation_function,
+                              low_level_zeroed_allocation_function,
+                              low_level_free_function,
+                              place_storage,
+                              context );
+}
+
+void Pool_set_placement_policy( struct Pool *self, enum Pool_placement_policy placement_policy )
+{
+    self->placement_policy = placement_policy;
+    self->free_stack_top = 0;
+}
+
 void Pool_terminate( struct Pool *self )
 {
-    if ( self->element_storage )
+    /* views over storage owned by someone else have no low level free function */
+    if ( self->element_storage && self->low_level_free_function )
     {
         self->low_level_free_function( self->element_storage );
     }
-    if ( self->allocated_flags )
+    if ( self->allocated_flags && self->low_level_free_function )
     {
         self->low_level_free_function( self->allocated_flags );
     }
+    if ( self->generations && self->low_level_free_function )
+    {
+        self->low_level_free_function( self->generations );
+    }
+    if ( self->tags && self->low_level_free_function )
+    {
+        self->low_level_free_function( self->tags );
+    }
     memset( self, 0, sizeof( *self ) );
 }
 
@@ -110,7 +252,38 @@ void *Pool_allocate_element( struct Pool *self )
     return r;
 }
 
-int Pool_deallocate_element( struct Pool *self, void *p )
+void *Pool_allocate_zeroed_element( struct Pool *self )
+{
+    void *r = 0;
+    if ( self->num_elements > 0 )
+    {
+        ssize_t item = Pool_find_next_available_element( self );
+
+        if ( item != -1 )
+        {
+            uint64_t bit = (uint64_t)1 << ( (size_t)item % POOL_FLAGS_BITS_PER_WORD );
+            Pool_mark_element_allocated( self, item );
+            r = Pool_get_address_for_element( self, item );
+            if ( self->dirty_flags[(size_t)item / POOL_FLAGS_BITS_PER_WORD] & bit )
+            {
+                memset( r, 0, self->element_size );
+                ++self->diag_num_clears;
+            }
+            else
+            {
+                ++self->diag_num_clears_skipped;
+            }
+            ++self->diag_num_allocations;
+        }
+        else
+        {
+            ++self->diag_num_spills;
+        }
+    }
+    return r;
+}
+
+ssize_t Pool_deallocate_element( struct Pool *self, void *p )
 {
     if ( self->num_elements > 0 )
     {
@@ -133,10 +306,8 @@ int Pool_is_element_available( struct Pool *self, size_t element_num )
     int r = 0;
     if ( element_num < self->num_elements )
     {
-        size_t element_div_8 = element_num / 8;
-        size_t element_mod_8 = element_num & 7;
-        unsigned char bit = ( 1 << element_mod_8 );
-        unsigned char flags = self->allocated_flags[element_div_8];
+        uint64_t bit = (uint64_t)1 << ( element_num % POOL_FLAGS_BITS_PER_WORD );
+        uint64_t flags = self->allocated_flags[element_num / POOL_FLAGS_BITS_PER_WORD];
 
         if ( ( flags & bit ) == 0 )
         {
@@ -152,10 +323,9 @@ int Pool_is_element_available( struct Pool *self, size_t element_num )
 
 void Pool_mark_element_allocated( struct Pool *self, size_t element_num )
 {
-    size_t element_div_8 = element_num / 8;
-    size_t element_mod_8 = element_num & 7;
-    unsigned char bit = ( 1 << element_mod_8 );
-    unsigned char flags = self->allocated_flags[element_div_8];
+    size_t word = element_num / POOL_FLAGS_BITS_PER_WORD;
+    uint64_t bit = (uint64_t)1 << ( element_num % POOL_FLAGS_BITS_PER_WORD );
+    uint64_t flags = self->allocated_flags[word];
 
     if ( ( flags & bit ) == bit )
     {
@@ -164,19 +334,27 @@ void Pool_mark_element_allocated( struct Pool *self, size_t element_num )
     }
     else
     {
-        self->allocated_flags[element_div_8] = flags | bit;
+        self->allocated_flags[word] = flags | bit;
+        if ( ( flags | bit ) == ~(uint64_t)0 )
+        {
+            self->full_flag_words[word / POOL_FLAGS_BITS_PER_WORD] |= (uint64_t)1 << ( word % POOL_FLAGS_BITS_PER_WORD );
+        }
         ++self->total_allocated_items;
-        self->next_available_hint = ( self->next_available_hint + 1 ) % self->num_elements;
+        if ( self->free_stack_top == element_num + 1 )
+        {
+            /* pop the free stack before the element is handed out and its link is overwritten */
+            memcpy( &self->free_stack_top, Pool_get_address_for_element( self, element_num ), sizeof( size_t ) );
+        }
+        /* every policy continues the scan just past the element that was handed out */
+        self->next_available_hint = element_num + 1 < self->num_elements ? element_num + 1 : 0;
     }
 }
 
 void Pool_mark_element_available( struct Pool *self, size_t element_num )
 {
-    size_t element_div_8 = element_num / 8;
-    size_t element_mod_8 = element_num & 7;
-    unsigned char bit = ( 1 << element_mod_8 );
-    unsigned char mask_bit = ~bit;
-    unsigned char flags = self->allocated_flags[element_div_8];
+    size_t word = element_num / POOL_FLAGS_BITS_PER_WORD;
+    uint64_t bit = (uint64_t)1 << ( element_num % POOL_FLAGS_BITS_PER_WORD );
+    uint64_t flags = self->allocated_flags[word];
 
     if ( ( flags & bit ) == 0 )
     {
@@ -185,10 +363,62 @@ void Pool_mark_element_available( struct Pool *self, size_t element_num )
     }
     else
     {
-        self->allocated_flags[element_div_8] = flags & mask_bit;
+        self->allocated_flags[word] = flags & ~bit;
+        self->dirty_flags[word] |= bit;
+        if ( __atomic_load_n( &self->remote_free_flags[word], __ATOMIC_RELAXED ) & bit )
+        {
+            __atomic_fetch_and( &self->remote_free_flags[word], ~bit, __ATOMIC_RELAXED );
+        }
+        if ( self->generations )
+        {
+            ++self->generations[element_num];
+        }
+        if ( flags == ~(uint64_t)0 )
+        {
+            self->full_flag_words[word / POOL_FLAGS_BITS_PER_WORD] &= ~( (uint64_t)1 << ( word % POOL_FLAGS_BITS_PER_WORD ) );
+        }
         --self->total_allocated_items;
-        self->next_available_hint = element_num;
+        switch ( self->placement_policy )
+        {
+        case POOL_PLACEMENT_LIFO:
+            self->next_available_hint = element_num;
+            if ( self->element_size >= sizeof( size_t ) )
+            {
+                memcpy( Pool_get_address_for_element( self, element_num ), &self->free_stack_top, sizeof( size_t ) );
+                self->free_stack_top = element_num + 1;
+            }
+            break;
+        case POOL_PLACEMENT_LOWEST_ADDRESS:
+            /* the hint is kept at or below the lowest available element */
+            if ( element_num < self->next_available_hint )
+            {
+                self->next_available_hint = element_num;
+            }
+            break;
+        case POOL_PLACEMENT_ROUND_ROBIN:
+            break;
+        }
+    }
+}
+
+int Pool_mark_element_remote_free( struct Pool *self, size_t element_num )
+{
+    int r = -1;
+    size_t word = element_num / POOL_FLAGS_BITS_PER_WORD;
+    uint64_t bit = (uint64_t)1 << ( element_num % POOL_FLAGS_BITS_PER_WORD );
+
+    /* only the owner changes the allocated flag of an element that is still allocated, so a relaxed read is stable here */
+    if ( ( __atomic_load_n( &self->allocated_flags[word], __ATOMIC_RELAXED ) & bit ) == 0
+         || ( __atomic_fetch_or( &self->remote_free_flags[word], bit, __ATOMIC_RELAXED ) & bit ) )
+    {
+        __atomic_add_fetch( &self->diag_multiple_deallocation_errors, 1, __ATOMIC_RELAXED );
+        POOL_ABORT( "Multiple deallocation" );
+    }
+    else
+    {
+        r = 0;
     }
+    return r;
 }
 
 void *Pool_get_address_for_element( struct Pool *self, size_t element_num )
@@ -203,36 +433,100 @@ void *Pool_get_address_for_element( struct Pool *self, size_t element_num )
     return r;
 }
 
-int Pool_is_address_in_pool( struct Pool *self, void const *p )
+/**
+ * @brief Pool_allocate_element_table Allocate a zeroed table of one byte per element, unless it already exists
+ */
+static int Pool_allocate_element_table( struct Pool *self, uint8_t **table )
 {
-    unsigned char *base = (unsigned char *)self->element_storage;
-    unsigned char *top = base + self->element_storage_size;
-    unsigned char const *pp = (unsigned char const *)p;
-    int r = 0;
+    int r = -1;
+    if ( *table || self->num_elements == 0 )
+    {
+        r = 0;
+    }
+    else if ( self->low_level_allocation_function )
+    {
+        *table = (uint8_t *)self->low_level_allocation_function( self->num_elements );
+        if ( *table )
+        {
+            memset( *table, 0, self->num_elements );
+            r = 0;
+        }
+    }
+    return r;
+}
 
-    if ( base <= pp && pp < top )
+int Pool_enable_handle_generations( struct Pool *self ) { return Pool_allocate_element_table( self, &self->generations ); }
+
+int Pool_enable_tags( struct Pool *self ) { return Pool_allocate_element_table( self, &self->tags ); }
+
+uint32_t Pool_allocate_handle( struct Pool *self )
+{
+    uint32_t r = POOL_HANDLE_INVALID;
+    if ( self->num_elements > 0 && self->num_elements <= POOL_HANDLE_MAX_ELEMENTS )
     {
-        int offset = (int)( pp - base );
-        if ( ( offset % self->element_size ) == 0 )
+        ssize_t item = Pool_find_next_available_element( self );
+
+        if ( item != -1 )
         {
-            r = 1;
+            uint32_t generation = self->generations ? self->generations[item] : 0;
+            Pool_mark_element_allocated( self, item );
+            r = ( (uint32_t)self->handle_id << ( POOL_HANDLE_INDEX_BITS + POOL_HANDLE_GENERATION_BITS ) )
+                | ( ( generation & ( ( 1u << POOL_HANDLE_GENERATION_BITS ) - 1 ) ) << POOL_HANDLE_INDEX_BITS )
+                | (uint32_t)item;
+            ++self->diag_num_allocations;
+        }
+        else
+        {
+            ++self->diag_num_spills;
         }
     }
     return r;
 }
 
+void *Pool_handle_to_ptr( struct Pool *self, uint32_t handle )
+{
+    void *r = 0;
+    size_t element_num = handle & ( ( 1u << POOL_HANDLE_INDEX_BITS ) - 1 );
+    uint32_t generation = ( handle >> POOL_HANDLE_INDEX_BITS ) & ( ( 1u << POOL_HANDLE_GENERATION_BITS ) - 1 );
+    /* a pool may have more elements than a handle can address, and the index of POOL_HANDLE_INVALID must stay invalid */
+    if ( ( handle >> ( POOL_HANDLE_INDEX_BITS + POOL_HANDLE_GENERATION_BITS ) ) == self->handle_id
+         && element_num < self->num_elements && element_num < POOL_HANDLE_MAX_ELEMENTS
+         && ( self->generations == 0
+              || ( self->generations[element_num] & ( ( 1u << POOL_HANDLE_GENERATION_BITS ) - 1 ) ) == generation ) )
+    {
+        r = self->element_storage + element_num * self->element_size;
+    }
+    return r;
+}
+
+void Pool_deallocate_handle( struct Pool *self, uint32_t handle )
+{
+    void *p = Pool_handle_to_ptr( self, handle );
+    if ( p == 0 )
+    {
+        POOL_ABORT( "Stale or foreign handle" );
+    }
+    else
+    {
+        Pool_deallocate_element( self, p );
+    }
+}
+
+int Pool_is_address_in_pool( struct Pool *self, void const *p ) { return Pool_get_element_for_address( self, p ) >= 0; }
+
 ssize_t Pool_get_element_for_address( struct Pool *self, void const *p )
 {
-    unsigned char *base = (unsigned char *)self->element_storage;
-    unsigned char *top = base + self->element_storage_size;
-    unsigned char const *pp = (unsigned char const *)p;
+    /* addresses below the base wrap around to huge offsets, so one comparison checks both bounds */
+    size_t offset = (size_t)( (uintptr_t)p - (uintptr_t)self->element_storage );
     ssize_t r = -1;
-    if ( base <= pp && pp < top )
+    if ( offset < self->element_storage_size && ( offset & ( ( (size_t)1 << self->element_size_shift ) - 1 ) ) == 0 )
     {
-        int offset = (int)( pp - base );
-        if ( ( offset % self->element_size ) == 0 )
+        /* exact division by multiplying with the inverse of the odd part: when the offset is not a multiple of
+         * element_size the product is at least 2^64 / element_size, which is never below num_elements */
+        uint64_t element_num = (uint64_t)( offset >> self->element_size_shift ) * self->element_size_inverse;
+        if ( element_num < self->num_elements )
         {
-            r = offset / self->element_size;
+            r = (ssize_t)element_num;
         }
     }
     return r;
@@ -243,47 +537,116 @@ ssize_t Pool_find_next_available_element( struct Pool *self )
     ssize_t r = -1;
     if ( self->element_storage_size > 0 )
     {
-        if ( self->total_allocated_items < self->num_elements )
+        if ( self->free_stack_top > 0 )
         {
-            size_t i;
-            size_t pos = self->next_available_hint;
-            for ( i = 0; i < self->num_elements; ++i )
+            size_t top = self->free_stack_top - 1;
+            if ( top < self->num_elements
+                 && ( self->allocated_flags[top / POOL_FLAGS_BITS_PER_WORD]
+                      & ( (uint64_t)1 << ( top % POOL_FLAGS_BITS_PER_WORD ) ) )
+                        == 0 )
             {
-                int item = ( pos + i ) % self->num_elements;
-                if ( Pool_is_element_available( self, item ) )
-                {
-                    r = item;
-                    self->next_available_hint = item;
-                    break;
-                }
+                r = (ssize_t)top;
+            }
+            else
+            {
+                /* an element on the stack was handed out out of order and its link overwritten; scan the flags instead */
+                self->free_stack_top = 0;
             }
         }
-        else
+        if ( r == -1 && self->total_allocated_items < self->num_elements )
         {
-            r = -1;
+            size_t num_flag_words = ( self->num_elements + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+            size_t num_summary_words = ( num_flag_words + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+            size_t pos = self->next_available_hint < self->num_elements ? self->next_available_hint : 0;
+            size_t word = pos / POOL_FLAGS_BITS_PER_WORD;
+            uint64_t available = ~self->allocated_flags[word] & ( ~(uint64_t)0 << ( pos % POOL_FLAGS_BITS_PER_WORD ) );
+
+            if ( available )
+            {
+                r = (ssize_t)( word * POOL_FLAGS_BITS_PER_WORD + (size_t)__builtin_ctzll( available ) );
+            }
+            else
+            {
+                /* find the next flag word that is not full, wrapping around; the extra iteration revisits the starting
+                 * summary word to pick up the words below the start after wrapping */
+                size_t next = word + 1 < num_flag_words ? word + 1 : 0;
+                size_t summary = next / POOL_FLAGS_BITS_PER_WORD;
+                uint64_t not_full
+                    = ~self->full_flag_words[summary] & ( ~(uint64_t)0 << ( next % POOL_FLAGS_BITS_PER_WORD ) );
+                size_t i;
+                for ( i = 0; i <= num_summary_words; ++i )
+                {
+                    if ( not_full )
+                    {
+                        word = summary * POOL_FLAGS_BITS_PER_WORD + (size_t)__builtin_ctzll( not_full );
+                        r = (ssize_t)( word * POOL_FLAGS_BITS_PER_WORD
+                                       + (size_t)__builtin_ctzll( ~self->allocated_flags[word] ) );
+                        break;
+                    }
+                    summary = summary + 1 < num_summary_words ? summary + 1 : 0;
+                    not_full = ~self->full_flag_words[summary];
+                }
+            }
         }
     }
     return r;
 }
 
-#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+size_t Pool_count_allocated( struct Pool *self )
+{
+    size_t num_flag_words = ( self->num_elements + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+    size_t r = 0;
+    size_t word;
+    for ( word = 0; word < num_flag_words; ++word )
+    {
+        r += (size_t)__builtin_popcountll( self->allocated_flags[word] );
+    }
+    /* the padding bits of the last word are always set */
+    return r - ( num_flag_words * POOL_FLAGS_BITS_PER_WORD - self->num_elements );
+}
 
-void Pool_diagnostics( struct Pool *self, const char *prefix, int ( *print )( const char * ) )
+size_t Pool_for_each_allocated( struct Pool *self,
+                                int ( *callback )( void *context, struct Pool *pool, void *element ),
+                                void *context )
 {
-    size_t actual_allocated_items = 0;
-    size_t i;
-    for ( i = 0; i < self->num_elements; ++i )
+    size_t num_flag_words = ( self->num_elements + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+    size_t num_padding_bits = num_flag_words * POOL_FLAGS_BITS_PER_WORD - self->num_elements;
+    size_t r = 0;
+    size_t word;
+    for ( word = 0; word < num_flag_words; ++word )
     {
-        if ( !Pool_is_element_available( self, i ) )
+        /* work on a copy of the word so that the callback may deallocate the element it was given */
+        uint64_t allocated = self->allocated_flags[word];
+        if ( word == num_flag_words - 1 && num_padding_bits > 0 )
         {
-            actual_allocated_items++;
+            allocated &= ~(uint64_t)0 >> num_padding_bits;
+        }
+        while ( allocated )
+        {
+            size_t element_num = word * POOL_FLAGS_BITS_PER_WORD + (size_t)__builtin_ctzll( allocated );
+            allocated &= allocated - 1;
+            ++r;
+            if ( callback( context, self, Pool_get_address_for_element( self, element_num ) ) )
+            {
+                return r;
+            }
         }
     }
+    return r;
+}
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+
+void Pool_diagnostics( struct Pool *self, const char *prefix, int ( *print )( const char * ) )
+{
+    size_t actual_allocated_items = Pool_count_allocated( self );
     char buf[128];
     sprintf( buf, "%selement_size                     : %zu", prefix, self->element_size );
     print( buf );
     sprintf( buf, "%snum_elements                     : %zu", prefix, self->num_elements );
     print( buf );
+    sprintf( buf, "%splacement_policy                 : %d", prefix, (int)self->placement_policy );
+    print( buf );
     sprintf( buf, "%stotal_allocated_items            : %zu", prefix, self->total_allocated_items );
     print( buf );
     sprintf( buf, "%sactual_allocated_items           : %zu", prefix, actual_allocated_items );
@@ -298,6 +661,10 @@ void Pool_diagnostics( struct Pool *self, const char *prefix, int ( *print )( co
     print( buf );
     sprintf( buf, "%sdiag_num_spills                  : %zu", prefix, self->diag_num_spills );
     print( buf );
+    sprintf( buf, "%sdiag_num_clears                  : %zu", prefix, self->diag_num_clears );
+    print( buf );
+    sprintf( buf, "%sdiag_num_clears_skipped          : %zu", prefix, self->diag_num_clears_skipped );
+    print( buf );
     print( "" );
 }
 
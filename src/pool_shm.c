@@ -0,0 +1,285 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pool_shm.h"
+
+/* element storage starts on its own cache line so that the shared counters do not share a line with the first element */
+#define POOL_SHM_STORAGE_ALIGNMENT ( 64 )
+
+static int PoolShm_is_shm_name( const char *name ) { return name[0] == '/' && strchr( name + 1, '/' ) == 0; }
+
+static int PoolShm_open_fd( const char *name, int flags )
+{
+    return PoolShm_is_shm_name( name ) ? shm_open( name, flags, 0600 ) : open( name, flags, 0600 );
+}
+
+static int PoolShm_map( struct PoolShm *self, int fd, size_t segment_size )
+{
+    int r = -1;
+    void *m = mmap( 0, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( m != MAP_FAILED )
+    {
+        self->header = (struct PoolShm_header *)m;
+        r = 0;
+    }
+    return r;
+}
+
+static void PoolShm_init_view( struct PoolShm *self )
+{
+    struct PoolShm_header *header = self->header;
+    unsigned char *base = (unsigned char *)header;
+    Pool_init_view( &self->view,
+                    (size_t)header->num_elements,
+                    (size_t)header->element_size,
+                    (uint64_t *)( base + header->allocated_flags_offset ),
+                    base + header->element_storage_offset );
+}
+
+int PoolShm_create( struct PoolShm *self, const char *name, size_t num_elements, size_t element_size )
+{
+    int r = -1;
+    size_t flags_offset = sizeof( struct PoolShm_header );
+    size_t storage_offset = ( flags_offset + Pool_allocated_flags_size( num_elements ) + POOL_SHM_STORAGE_ALIGNMENT - 1 )
+                            & ~(size_t)( POOL_SHM_STORAGE_ALIGNMENT - 1 );
+    size_t segment_size = storage_offset + num_elements * element_size;
+    int fd;
+    memset( self, 0, sizeof( *self ) );
+    if ( num_elements == 0 || element_size == 0 || ( segment_size - storage_offset ) / element_size != num_elements )
+    {
+        return -1;
+    }
+    /* an existing segment may still be in use by another process, so it is never replaced; the open fails with EEXIST */
+    fd = PoolShm_open_fd( name, O_RDWR | O_CREAT | O_EXCL );
+    if ( fd >= 0 )
+    {
+        /* a freshly sized segment reads as zeros, so only the header and the flag padding need to be written */
+        if ( ftruncate( fd, (off_t)segment_size ) == 0 && PoolShm_map( self, fd, segment_size ) == 0 )
+        {
+            struct PoolShm_header *header = self->header;
+            header->segment_size = segment_size;
+            header->num_elements = num_elements;
+            header->element_size = element_size;
+            header->allocated_flags_offset = flags_offset;
+            header->element_storage_offset = storage_offset;
+            PoolShm_init_view( self );
+            Pool_clear_allocated_flags( &self->view );
+            __atomic_store_n( &header->magic, POOL_SHM_MAGIC, __ATOMIC_RELEASE );
+            r = 0;
+        }
+        close( fd );
+    }
+    return r;
+}
+
+/**
+ * @brief PoolShm_is_valid_layout Check that the flags and the element storage described by a header lie inside the
+ * segment and do not overlap, so that a corrupt or foreign segment is never accessed out of bounds
+ */
+static int PoolShm_is_valid_layout( const struct PoolShm_header *header, size_t segment_size )
+{
+    size_t num_elements = (size_t)header->num_elements;
+    size_t element_size = (size_t)header->element_size;
+    size_t flags_offset = (size_t)header->allocated_flags_offset;
+    size_t storage_offset = (size_t)header->element_storage_offset;
+    int r = 0;
+    if ( header->segment_size == (uint64_t)segment_size && num_elements > 0 && element_size > 0
+         && num_elements <= segment_size && flags_offset >= sizeof( struct PoolShm_header )
+         && flags_offset % sizeof( uint64_t ) == 0 && flags_offset <= storage_offset && storage_offset <= segment_size
+         && storage_offset - flags_offset >= Pool_allocated_flags_size( num_elements )
+         && ( segment_size - storage_offset ) / element_size >= num_elements )
+    {
+        r = 1;
+    }
+    return r;
+}
+
+int PoolShm_open( struct PoolShm *self, const char *name )
+{
+    int r = -1;
+    int fd = PoolShm_open_fd( name, O_RDWR );
+    memset( self, 0, sizeof( *self ) );
+    if ( fd >= 0 )
+    {
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 && (size_t)st.st_size >= sizeof( struct PoolShm_header )
+             && PoolShm_map( self, fd, (size_t)st.st_size ) == 0 )
+        {
+            struct PoolShm_header *header = self->header;
+            if ( __atomic_load_n( &header->magic, __ATOMIC_ACQUIRE ) == POOL_SHM_MAGIC
+                 && PoolShm_is_valid_layout( header, (size_t)st.st_size ) )
+            {
+                PoolShm_init_view( self );
+                r = 0;
+            }
+            else
+            {
+                munmap( header, (size_t)st.st_size );
+                self->header = 0;
+            }
+        }
+        close( fd );
+    }
+    return r;
+}
+
+void PoolShm_close( struct PoolShm *self )
+{
+    if ( self->header )
+    {
+        munmap( self->header, (size_t)self->header->segment_size );
+    }
+    memset( self, 0, sizeof( *self ) );
+}
+
+int PoolShm_unlink( const char *name ) { return PoolShm_is_shm_name( name ) ? shm_unlink( name ) : unlink( name ); }
+
+ssize_t PoolShm_allocate_index( struct PoolShm *self )
+{
+    struct PoolShm_header *header = self->header;
+    uint64_t *flags = self->view.allocated_flags;
+    size_t num_flag_words = ( self->view.num_elements + POOL_FLAGS_BITS_PER_WORD - 1 ) / POOL_FLAGS_BITS_PER_WORD;
+    size_t word = (size_t)( __atomic_load_n( &header->next_available_hint, __ATOMIC_RELAXED ) / POOL_FLAGS_BITS_PER_WORD );
+    size_t i;
+    if ( word >= num_flag_words )
+    {
+        word = 0;
+    }
+    for ( i = 0; i < num_flag_words; ++i )
+    {
+        uint64_t current = __atomic_load_n( &flags[word], __ATOMIC_RELAXED );
+        while ( ~current )
+        {
+            uint64_t bit = (uint64_t)1 << __builtin_ctzll( ~current );
+            /* on failure current is refreshed with the value another process or thread stored */
+            if ( __atomic_compare_exchange_n(
+                     &flags[word], &current, current | bit, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+            {
+                size_t element_num = word * POOL_FLAGS_BITS_PER_WORD + (size_t)__builtin_ctzll( bit );
+                __atomic_add_fetch( &header->total_allocated_items, 1, __ATOMIC_RELAXED );
+                __atomic_add_fetch( &header->diag_num_allocations, 1, __ATOMIC_RELAXED );
+                __atomic_store_n( &header->next_available_hint, element_num, __ATOMIC_RELAXED );
+                return (ssize_t)element_num;
+            }
+        }
+        word = word + 1 < num_flag_words ? word + 1 : 0;
+    }
+    __atomic_add_fetch( &header->diag_num_spills, 1, __ATOMIC_RELAXED );
+    return -1;
+}
+
+int PoolShm_deallocate_index( struct PoolShm *self, size_t element_num )
+{
+    struct PoolShm_header *header = self->header;
+    int r = -1;
+    if ( element_num < self->view.num_elements )
+    {
+        uint64_t bit = (uint64_t)1 << ( element_num % POOL_FLAGS_BITS_PER_WORD );
+        uint64_t previous = __atomic_fetch_and(
+            &self->view.allocated_flags[element_num / POOL_FLAGS_BITS_PER_WORD], ~bit, __ATOMIC_RELEASE );
+        if ( previous & bit )
+        {
+            __atomic_sub_fetch( &header->total_allocated_items, 1, __ATOMIC_RELAXED );
+            __atomic_add_fetch( &header->diag_num_frees, 1, __ATOMIC_RELAXED );
+            r = 0;
+        }
+        else
+        {
+            __atomic_add_fetch( &header->diag_multiple_deallocation_errors, 1, __ATOMIC_RELAXED );
+            POOL_ABORT( "Multiple deallocation" );
+        }
+    }
+    return r;
+}
+
+void *PoolShm_allocate_element( struct PoolShm *self )
+{
+    ssize_t element_num = PoolShm_allocate_index( self );
+    return element_num >= 0 ? Pool_get_address_for_element( &self->view, (size_t)element_num ) : 0;
+}
+
+ssize_t PoolShm_deallocate_element( struct PoolShm *self, void *p )
+{
+    ssize_t element_num = Pool_get_element_for_address( &self->view, p );
+    if ( element_num >= 0 && PoolShm_deallocate_index( self, (size_t)element_num ) != 0 )
+    {
+        element_num = -1;
+    }
+    return element_num;
+}
+
+void *PoolShm_get_address_for_element( struct PoolShm *self, size_t element_num )
+{
+    return element_num < self->view.num_elements ? Pool_get_address_for_element( &self->view, element_num ) : 0;
+}
+
+ssize_t PoolShm_get_element_for_address( struct PoolShm *self, void const *p )
+{
+    return Pool_get_element_for_address( &self->view, p );
+}
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+void PoolShm_diagnostics( struct PoolShm *self, const char *prefix, int ( *print )( const char * ) )
+{
+    struct PoolShm_header *header = self->header;
+    char buf[128];
+    sprintf( buf, "%selement_size                     : %llu", prefix, (unsigned long long)header->element_size );
+    print( buf );
+    sprintf( buf, "%snum_elements                     : %llu", prefix, (unsigned long long)header->num_elements );
+    print( buf );
+    sprintf( buf,
+             "%stotal_allocated_items            : %llu",
+             prefix,
+             (unsigned long long)__atomic_load_n( &header->total_allocated_items, __ATOMIC_RELAXED ) );
+    print( buf );
+    sprintf( buf,
+             "%sdiag_multiple_deallocation_errors: %llu",
+             prefix,
+             (unsigned long long)__atomic_load_n( &header->diag_multiple_deallocation_errors, __ATOMIC_RELAXED ) );
+    print( buf );
+    sprintf( buf,
+             "%sdiag_num_allocations             : %llu",
+             prefix,
+             (unsigned long long)__atomic_load_n( &header->diag_num_allocations, __ATOMIC_RELAXED ) );
+    print( buf );
+    sprintf( buf,
+             "%sdiag_num_frees                   : %llu",
+             prefix,
+             (unsigned long long)__atomic_load_n( &header->diag_num_frees, __ATOMIC_RELAXED ) );
+    print( buf );
+    sprintf( buf,
+             "%sdiag_num_spills                  : %llu",
+             prefix,
+             (unsigned long long)__atomic_load_n( &header->diag_num_spills, __ATOMIC_RELAXED ) );
+    print( buf );
+    print( "" );
+}
+#endif
@@ -26,6 +26,95 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "pools.h"
+#include "pools_maintainer.h"
+#include "pools_numa.h"
+
+static __thread char pools_thread_token;
+
+const void *Pools_current_thread( void ) { return &pools_thread_token; }
+
+static int Pools_is_owner( struct Pools *self )
+{
+    const void *owner = __atomic_load_n( &self->owner_thread, __ATOMIC_RELAXED );
+    return owner == 0 || owner == Pools_current_thread();
+}
+
+/*
+ * Only the owner changes the pool array. It makes layout_sequence odd for the duration, and other threads copy what they
+ * need out of the array and retry if the sequence moved underneath them.
+ */
+static void Pools_layout_write_begin( struct Pools *self )
+{
+    __atomic_store_n( &self->layout_sequence, self->layout_sequence + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+static void Pools_layout_write_end( struct Pools *self )
+{
+    __atomic_store_n( &self->layout_sequence, self->layout_sequence + 1, __ATOMIC_RELEASE );
+}
+
+static size_t Pools_layout_read_begin( struct Pools *self )
+{
+    size_t sequence;
+    while ( ( sequence = __atomic_load_n( &self->layout_sequence, __ATOMIC_ACQUIRE ) ) & 1 )
+    {
+    }
+    return sequence;
+}
+
+static int Pools_layout_read_retry( struct Pools *self, size_t sequence )
+{
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    return __atomic_load_n( &self->layout_sequence, __ATOMIC_RELAXED ) != sequence;
+}
+
+/* a copy of a pool may be used to reach its flags until the reader exits; removed pools outlive every reader */
+static void Pools_layout_reader_enter( struct Pools *self )
+{
+    __atomic_add_fetch( &self->num_layout_readers, 1, __ATOMIC_SEQ_CST );
+}
+
+static void Pools_layout_reader_exit( struct Pools *self )
+{
+    __atomic_sub_fetch( &self->num_layout_readers, 1, __ATOMIC_RELEASE );
+}
+
+/**
+ * @brief Pools_copy_pool_for_address  Copy the pool that owns a pointer, from any thread
+ */
+static int Pools_copy_pool_for_address( struct Pools *self, void const *p, struct Pool *copy )
+{
+    int r;
+    size_t sequence;
+    size_t num_pools;
+    size_t i;
+    do
+    {
+        sequence = Pools_layout_read_begin( self );
+        num_pools = __atomic_load_n( &self->num_pools, __ATOMIC_RELAXED );
+        r = 0;
+        for ( i = 0; i < num_pools && i < POOLS_MAX_POOLS; ++i )
+        {
+            if ( Pool_is_address_in_pool( &self->pool[i], p ) )
+            {
+                *copy = self->pool[i];
+                r = 1;
+                break;
+            }
+        }
+    } while ( Pools_layout_read_retry( self, sequence ) );
+    return r;
+}
+
+/* pools grown or trimmed by the maintainer are put in place by the owner, between allocations */
+static void Pools_apply_maintenance( struct Pools *self )
+{
+    if ( self->maintainer && __atomic_load_n( &self->maintainer->work_pending, __ATOMIC_RELAXED ) )
+    {
+        PoolsMaintainer_apply( self->maintainer );
+    }
+}
 
 int Pools_init( struct Pools *self,
                 const char *name,
@@ -40,22 +129,193 @@ int Pools_init( struct Pools *self,
     self->diag_num_spills_handled = 0;
     self->diag_num_spills_to_heap = 0;
     self->num_pools = 0;
+    self->owner_thread = Pools_current_thread();
+    self->remote_free_head = 0;
+    self->diag_num_remote_frees = 0;
+    self->num_remote_frees_drained = 0;
+    self->diag_num_remote_drains = 0;
+    self->numa_node = -1;
+    self->diag_num_bind_failures = 0;
+    self->low_level_reallocation_function = 0;
+    self->low_level_zeroed_allocation_function = 0;
+    self->diag_num_reallocs_in_place = 0;
+    self->diag_num_reallocs_moved = 0;
+    memset( &self->trace, 0, sizeof( self->trace ) );
+    memset( &self->profile, 0, sizeof( self->profile ) );
+    memset( &self->epoch, 0, sizeof( self->epoch ) );
+    self->handle_generations = 0;
+    self->next_handle_id = 0;
+    memset( self->handle_pool_index, 0, sizeof( self->handle_pool_index ) );
+    self->tagging = 0;
+    memset( self->tag, 0, sizeof( self->tag ) );
+    self->maintainer = 0;
+    self->layout_sequence = 0;
+    self->num_layout_readers = 0;
     r = 0;
     return r;
 }
 
+void Pools_set_low_level_reallocation_function( struct Pools *self,
+                                                void *( *low_level_reallocation_function )( void *, size_t ) )
+{
+    self->low_level_reallocation_function = low_level_reallocation_function;
+}
+
+void Pools_set_low_level_zeroed_allocation_function( struct Pools *self,
+                                                     void *( *low_level_zeroed_allocation_function )( size_t, size_t ) )
+{
+    self->low_level_zeroed_allocation_function = low_level_zeroed_allocation_function;
+}
+
+void Pools_set_owner_thread( struct Pools *self )
+{
+    __atomic_store_n( &self->owner_thread, Pools_current_thread(), __ATOMIC_RELEASE );
+}
+
+/* binds new element storage to the node of the Pools before Pool_init_placed clears it, so no page has to be migrated */
+static void Pools_bind_storage( void *context, struct Pool *pool )
+{
+    struct Pools *self = (struct Pools *)context;
+    if ( Pool_bind_to_numa_node( pool, self->numa_node ) != 0 )
+    {
+        /* the maintainer initializes pools on its own thread */
+        __atomic_add_fetch( &self->diag_num_bind_failures, 1, __ATOMIC_RELAXED );
+    }
+}
+
+int Pools_init_pool( struct Pools *self, struct Pool *pool, size_t element_size, size_t number_of_elements )
+{
+    return Pool_init_placed( pool,
+                             number_of_elements,
+                             element_size,
+                             self->low_level_allocation_function,
+                             self->low_level_zeroed_allocation_function,
+                             self->low_level_free_function,
+                             self->numa_node >= 0 ? Pools_bind_storage : 0,
+                             self );
+}
+
+/* called by the owner just before a pool joins the array, so that the settings of the Pools are read where they change */
+static int Pools_adopt_pool( struct Pools *self, struct Pool *pool )
+{
+    int r = -1;
+    unsigned int used_ids = 0;
+    unsigned int id;
+    size_t i;
+    if ( ( !self->handle_generations || Pool_enable_handle_generations( pool ) == 0 )
+         && ( !self->tagging || Pool_enable_tags( pool ) == 0 ) )
+    {
+        /* the next id after the last one handed out that no current pool has, so that the id of a removed pool is
+         * reused as late as possible and its stale handles do not resolve into the pool that replaces it */
+        for ( i = 0; i < self->num_pools; ++i )
+        {
+            used_ids |= 1u << self->pool[i].handle_id;
+        }
+        for ( id = self->next_handle_id; used_ids & ( 1u << id ); id = ( id + 1 ) % ( 1u << POOL_HANDLE_ID_BITS ) )
+        {
+        }
+        pool->handle_id = id;
+        self->next_handle_id = ( id + 1 ) % ( 1u << POOL_HANDLE_ID_BITS );
+        r = 0;
+    }
+    return r;
+}
+
 int Pools_add( struct Pools *self, size_t element_size, size_t number_of_elements )
 {
     int r = -1;
+    if ( element_size > 0 && element_size < sizeof( void * ) )
+    {
+        element_size = sizeof( void * );
+    }
     if ( self->num_pools < POOLS_MAX_POOLS )
     {
-        struct Pool *pool = &self->pool[self->num_pools];
-        r = Pool_init(
-            pool, number_of_elements, element_size, self->low_level_allocation_function, self->low_level_free_function );
+        r = Pools_init_pool( self, &self->pool[self->num_pools], element_size, number_of_elements );
+        if ( r == 0 && Pools_adopt_pool( self, &self->pool[self->num_pools] ) )
+        {
+            Pool_terminate( &self->pool[self->num_pools] );
+            r = -1;
+        }
         if ( r == 0 )
         {
+            Pools_layout_write_begin( self );
             ++self->num_pools;
+            Pools_layout_write_end( self );
+        }
+    }
+    return r;
+}
+
+int Pools_insert_pool( struct Pools *self, struct Pool *pool )
+{
+    int r = -1;
+    size_t position;
+    size_t i;
+    if ( self->num_pools < POOLS_MAX_POOLS && Pools_adopt_pool( self, pool ) == 0 )
+    {
+        position = self->num_pools;
+        for ( i = self->num_pools; i > 0; --i )
+        {
+            if ( self->pool[i - 1].element_size == pool->element_size )
+            {
+                position = i;
+                break;
+            }
+        }
+        Pools_layout_write_begin( self );
+        for ( i = self->num_pools; i > position; --i )
+        {
+            self->pool[i] = self->pool[i - 1];
+        }
+        self->pool[position] = *pool;
+        ++self->num_pools;
+        Pools_layout_write_end( self );
+        r = 0;
+    }
+    return r;
+}
+
+void Pools_remove_pool( struct Pools *self, size_t index, struct Pool *removed )
+{
+    size_t i;
+    *removed = self->pool[index];
+    Pools_layout_write_begin( self );
+    for ( i = index; i + 1 < self->num_pools; ++i )
+    {
+        self->pool[i] = self->pool[i + 1];
+    }
+    --self->num_pools;
+    Pools_layout_write_end( self );
+}
+
+size_t Pools_copy_layout( struct Pools *self, struct Pool *pools )
+{
+    size_t sequence;
+    size_t num_pools;
+    size_t i;
+    do
+    {
+        sequence = Pools_layout_read_begin( self );
+        num_pools = __atomic_load_n( &self->num_pools, __ATOMIC_RELAXED );
+        num_pools = num_pools < POOLS_MAX_POOLS ? num_pools : POOLS_MAX_POOLS;
+        for ( i = 0; i < num_pools; ++i )
+        {
+            pools[i] = self->pool[i];
+            pools[i].total_allocated_items = __atomic_load_n( &self->pool[i].total_allocated_items, __ATOMIC_RELAXED );
         }
+    } while ( Pools_layout_read_retry( self, sequence ) );
+    return num_pools;
+}
+
+int Pools_add_with_policy( struct Pools *self,
+                           size_t element_size,
+                           size_t number_of_elements,
+                           enum Pool_placement_policy placement_policy )
+{
+    int r = Pools_add( self, element_size, number_of_elements );
+    if ( r == 0 )
+    {
+        Pool_set_placement_policy( &self->pool[self->num_pools - 1], placement_policy );
     }
     return r;
 }
@@ -63,6 +323,14 @@ int Pools_add( struct Pools *self, size_t element_size, size_t number_of_element
 void Pools_terminate( struct Pools *self )
 {
     size_t n;
+    if ( self->maintainer )
+    {
+        PoolsMaintainer_terminate( self->maintainer );
+    }
+    Pools_trace_stop( self );
+    Pools_epoch_terminate( self );
+    Pools_drain_remote_frees( self );
+    Pools_profile_stop( self );
     for ( n = 0; n < self->num_pools; ++n )
     {
         Pool_terminate( &self->pool[n] );
@@ -71,17 +339,57 @@ void Pools_terminate( struct Pools *self )
     self->low_level_free_function = 0;
 }
 
-void *Pools_allocate_element( struct Pools *self, size_t size )
+/**
+ * @brief Pools_tag_admit  Check whether a tag may take one more element of a pool, counting it when it may not
+ */
+static int Pools_tag_admit( struct Pools *self, unsigned int tag, struct Pool *pool )
+{
+    struct Pools_tag *t = &self->tag[tag];
+    int r = ( t->max_elements == 0 || t->num_elements < t->max_elements )
+            && ( t->max_bytes == 0 || t->num_bytes + pool->element_size <= t->max_bytes );
+    if ( !r )
+    {
+        ++t->diag_num_over_budget;
+    }
+    return r;
+}
+
+static void Pools_tag_charge( struct Pools *self, unsigned int tag, struct Pool *pool, void *p )
+{
+    pool->tags[Pool_get_element_for_address( pool, p )] = (uint8_t)tag;
+    ++self->tag[tag].num_elements;
+    self->tag[tag].num_bytes += pool->element_size;
+}
+
+static void *Pools_allocate( struct Pools *self, size_t size, int zeroed, unsigned int tag, size_t *class_size )
 {
     void *r = 0;
     size_t i;
+    int over_budget = 0;
+    /* a remote free of a heap spill while profiling links it through its first word, so spills hold at least a pointer */
+    size_t heap_size = size < sizeof( void * ) ? sizeof( void * ) : size;
+    Pools_apply_maintenance( self );
+    if ( __atomic_load_n( &self->remote_free_head, __ATOMIC_RELAXED ) )
+    {
+        Pools_drain_remote_frees( self );
+    }
     for ( i = 0; i < self->num_pools; ++i )
     {
         if ( size <= self->pool[i].element_size )
         {
-            r = Pool_allocate_element( &self->pool[i] );
+            if ( self->tagging && !Pools_tag_admit( self, tag, &self->pool[i] ) )
+            {
+                over_budget = 1;
+                i = self->num_pools;
+                break;
+            }
+            r = zeroed ? Pool_allocate_zeroed_element( &self->pool[i] ) : Pool_allocate_element( &self->pool[i] );
             if ( r != 0 )
             {
+                if ( self->pool[i].tags )
+                {
+                    Pools_tag_charge( self, tag, &self->pool[i], r );
+                }
                 break;
             }
             else
@@ -90,37 +398,533 @@ void *Pools_allocate_element( struct Pools *self, size_t size )
             }
         }
     }
-    if ( r == 0 && self->low_level_allocation_function )
+    /* a tag at its budget gets nothing, not a heap spill, so that its budget bounds its memory and not just its share of
+     * the pools */
+    if ( r == 0 && !over_budget && zeroed && self->low_level_zeroed_allocation_function )
     {
         ++self->diag_num_spills_to_heap;
-        r = self->low_level_allocation_function( size );
+        r = self->low_level_zeroed_allocation_function( 1, heap_size );
+    }
+    else if ( r == 0 && !over_budget && self->low_level_allocation_function )
+    {
+        ++self->diag_num_spills_to_heap;
+        r = self->low_level_allocation_function( heap_size );
+        if ( r && zeroed )
+        {
+            memset( r, 0, size );
+        }
+    }
+    if ( self->trace.header && r )
+    {
+        Pools_trace_record( &self->trace, POOLS_TRACE_ALLOCATE, size, r );
     }
+    *class_size = i < self->num_pools ? self->pool[i].element_size : 0;
     return r;
 }
 
-void Pools_deallocate_element( struct Pools *self, void *p )
+/* the profiler hook is in each entry point so that the sampled stack always starts one frame above the caller */
+
+void *Pools_allocate_element( struct Pools *self, size_t size )
+{
+    size_t class_size;
+    void *r = Pools_allocate( self, size, 0, 0, &class_size );
+    if ( self->profile.sites && r && ( self->profile.bytes_until_sample -= (ptrdiff_t)size ) <= 0 )
+    {
+        Pools_profile_record_allocation( &self->profile, class_size, r );
+    }
+    return r;
+}
+
+void *Pools_allocate_zeroed( struct Pools *self, size_t size )
 {
+    size_t class_size;
+    void *r = Pools_allocate( self, size, 1, 0, &class_size );
+    if ( self->profile.sites && r && ( self->profile.bytes_until_sample -= (ptrdiff_t)size ) <= 0 )
+    {
+        Pools_profile_record_allocation( &self->profile, class_size, r );
+    }
+    return r;
+}
+
+void *Pools_allocate_tagged( struct Pools *self, size_t size, unsigned int tag )
+{
+    size_t class_size;
+    void *r;
+    if ( tag >= POOLS_MAX_TAGS )
+    {
+        POOL_ABORT( "Tag out of range" );
+        tag = 0;
+    }
+    r = Pools_allocate( self, size, 0, tag, &class_size );
+    if ( self->profile.sites && r && ( self->profile.bytes_until_sample -= (ptrdiff_t)size ) <= 0 )
+    {
+        Pools_profile_record_allocation( &self->profile, class_size, r );
+    }
+    return r;
+}
+
+int Pools_set_tag_budget( struct Pools *self, unsigned int tag, size_t max_bytes, size_t max_elements )
+{
+    int r = -1;
     size_t i;
-    int deallocated = 0;
-    if ( p )
+    if ( tag < POOLS_MAX_TAGS )
     {
-        for ( i = 0; i < self->num_pools; ++i )
+        r = 0;
+        if ( !self->tagging )
         {
-            if ( Pool_is_address_in_pool( &self->pool[i], p ) )
+            for ( i = 0; i < self->num_pools && r == 0; ++i )
+            {
+                r = Pool_enable_tags( &self->pool[i] );
+            }
+            if ( r == 0 )
+            {
+                /* the zeroed tag tables already say that everything allocated so far belongs to tag 0 */
+                for ( i = 0; i < self->num_pools; ++i )
+                {
+                    self->tag[0].num_elements += self->pool[i].total_allocated_items;
+                    self->tag[0].num_bytes += self->pool[i].total_allocated_items * self->pool[i].element_size;
+                }
+                self->tagging = 1;
+            }
+        }
+        if ( r == 0 )
+        {
+            self->tag[tag].max_bytes = max_bytes;
+            self->tag[tag].max_elements = max_elements;
+        }
+    }
+    return r;
+}
+
+uint32_t Pools_allocate_handle( struct Pools *self, size_t size ) { return Pools_allocate_handle_tagged( self, size, 0 ); }
+
+uint32_t Pools_allocate_handle_tagged( struct Pools *self, size_t size, unsigned int tag )
+{
+    uint32_t r = POOL_HANDLE_INVALID;
+    size_t i;
+    if ( tag >= POOLS_MAX_TAGS )
+    {
+        POOL_ABORT( "Tag out of range" );
+        tag = 0;
+    }
+    Pools_apply_maintenance( self );
+    if ( __atomic_load_n( &self->remote_free_head, __ATOMIC_RELAXED ) )
+    {
+        Pools_drain_remote_frees( self );
+    }
+    for ( i = 0; i < self->num_pools; ++i )
+    {
+        if ( size <= self->pool[i].element_size )
+        {
+            if ( self->tagging && !Pools_tag_admit( self, tag, &self->pool[i] ) )
+            {
+                break;
+            }
+            r = Pool_allocate_handle( &self->pool[i] );
+            if ( r != POOL_HANDLE_INVALID )
             {
-                Pool_deallocate_element( &self->pool[i], p );
-                deallocated = 1;
+                if ( self->pool[i].tags )
+                {
+                    Pools_tag_charge( self, tag, &self->pool[i], Pool_handle_to_ptr( &self->pool[i], r ) );
+                }
+                if ( self->trace.header )
+                {
+                    Pools_trace_record( &self->trace, POOLS_TRACE_ALLOCATE, size, Pool_handle_to_ptr( &self->pool[i], r ) );
+                }
                 break;
             }
+            else
+            {
+                ++self->diag_num_spills_handled;
+            }
         }
-        if ( !deallocated && self->low_level_free_function )
+    }
+    return r;
+}
+
+void *Pools_handle_to_ptr( struct Pools *self, uint32_t handle )
+{
+    void *r = 0;
+    unsigned int handle_id = handle >> ( POOL_HANDLE_INDEX_BITS + POOL_HANDLE_GENERATION_BITS );
+    int is_owner = Pools_is_owner( self );
+    struct Pool copy;
+    size_t sequence = 0;
+    size_t num_pools;
+    size_t i;
+    if ( !is_owner )
+    {
+        Pools_layout_reader_enter( self );
+    }
+    do
+    {
+        if ( !is_owner )
+        {
+            sequence = Pools_layout_read_begin( self );
+        }
+        num_pools = __atomic_load_n( &self->num_pools, __ATOMIC_RELAXED );
+        num_pools = num_pools < POOLS_MAX_POOLS ? num_pools : POOLS_MAX_POOLS;
+        i = __atomic_load_n( &self->handle_pool_index[handle_id], __ATOMIC_RELAXED );
+        if ( i >= num_pools || self->pool[i].handle_id != handle_id )
         {
-            ++self->diag_num_frees_from_heap;
-            self->low_level_free_function( p );
+            for ( i = 0; i < num_pools && self->pool[i].handle_id != handle_id; ++i )
+            {
+            }
+            __atomic_store_n( &self->handle_pool_index[handle_id], (unsigned char)i, __ATOMIC_RELAXED );
         }
+        if ( i < num_pools )
+        {
+            copy = self->pool[i];
+        }
+    } while ( !is_owner && Pools_layout_read_retry( self, sequence ) );
+    if ( i < num_pools )
+    {
+        r = Pool_handle_to_ptr( &copy, handle );
+    }
+    if ( !is_owner )
+    {
+        Pools_layout_reader_exit( self );
+    }
+    return r;
+}
+
+void Pools_deallocate_handle( struct Pools *self, uint32_t handle )
+{
+    void *p = Pools_handle_to_ptr( self, handle );
+    if ( p == 0 )
+    {
+        POOL_ABORT( "Stale or foreign handle" );
+    }
+    else
+    {
+        Pools_deallocate_element( self, p );
+    }
+}
+
+int Pools_enable_handle_generations( struct Pools *self )
+{
+    int r = 0;
+    size_t i;
+    self->handle_generations = 1;
+    for ( i = 0; i < self->num_pools; ++i )
+    {
+        if ( Pool_enable_handle_generations( &self->pool[i] ) )
+        {
+            r = -1;
+        }
+    }
+    return r;
+}
+
+struct Pool *Pools_find_pool_for_address( struct Pools *self, void const *p )
+{
+    size_t i;
+    for ( i = 0; i < self->num_pools; ++i )
+    {
+        if ( Pool_is_address_in_pool( &self->pool[i], p ) )
+        {
+            return &self->pool[i];
+        }
+    }
+    return 0;
+}
+
+int Pools_owns_address( struct Pools *self, void const *p )
+{
+    int r;
+    size_t sequence;
+    size_t num_pools;
+    size_t i;
+    /* only the storage and shape of each pool are read, which change only under the layout sequence, unlike the counters
+     * that a copy would read */
+    do
+    {
+        sequence = Pools_layout_read_begin( self );
+        num_pools = __atomic_load_n( &self->num_pools, __ATOMIC_RELAXED );
+        r = 0;
+        for ( i = 0; i < num_pools && i < POOLS_MAX_POOLS && !r; ++i )
+        {
+            r = Pool_is_address_in_pool( &self->pool[i], p );
+        }
+    } while ( Pools_layout_read_retry( self, sequence ) );
+    return r;
+}
+
+struct Pools_for_each_state
+{
+    int ( *callback )( void *context, struct Pool *pool, void *element );
+    void *context;
+    int stopped;
+};
+
+static int Pools_for_each_trampoline( void *state_ptr, struct Pool *pool, void *element )
+{
+    struct Pools_for_each_state *state = (struct Pools_for_each_state *)state_ptr;
+    state->stopped = state->callback( state->context, pool, element );
+    return state->stopped;
+}
+
+size_t Pools_for_each_allocated( struct Pools *self,
+                                 int ( *callback )( void *context, struct Pool *pool, void *element ),
+                                 void *context )
+{
+    struct Pools_for_each_state state;
+    size_t r = 0;
+    size_t i;
+    state.callback = callback;
+    state.context = context;
+    state.stopped = 0;
+    if ( Pools_is_owner( self ) )
+    {
+        if ( __atomic_load_n( &self->owner_thread, __ATOMIC_RELAXED ) == Pools_current_thread() )
+        {
+            Pools_drain_remote_frees( self );
+        }
+        for ( i = 0; i < self->num_pools && !state.stopped; ++i )
+        {
+            if ( self->pool[i].total_allocated_items )
+            {
+                r += Pool_for_each_allocated( &self->pool[i], Pools_for_each_trampoline, &state );
+            }
+        }
+    }
+    else
+    {
+        struct Pool copies[POOLS_MAX_POOLS];
+        size_t num_pools;
+        Pools_layout_reader_enter( self );
+        num_pools = Pools_copy_layout( self, copies );
+        for ( i = 0; i < num_pools && !state.stopped; ++i )
+        {
+            if ( copies[i].total_allocated_items )
+            {
+                r += Pool_for_each_allocated( &copies[i], Pools_for_each_trampoline, &state );
+            }
+        }
+        Pools_layout_reader_exit( self );
+    }
+    return r;
+}
+
+size_t Pools_usable_size( struct Pools *self, void const *p )
+{
+    size_t r = 0;
+    if ( Pools_is_owner( self ) )
+    {
+        struct Pool *pool = Pools_find_pool_for_address( self, p );
+        r = pool ? pool->element_size : 0;
+    }
+    else
+    {
+        struct Pool copy;
+        if ( Pools_copy_pool_for_address( self, p, &copy ) )
+        {
+            r = copy.element_size;
+        }
+    }
+    return r;
+}
+
+static void Pools_deallocate_local( struct Pools *self, void *p )
+{
+    struct Pool *pool = Pools_find_pool_for_address( self, p );
+    if ( self->profile.num_live )
+    {
+        Pools_profile_record_deallocation( &self->profile, p );
+    }
+    if ( pool )
+    {
+        ssize_t item = Pool_deallocate_element( pool, p );
+        if ( pool->tags && item >= 0 )
+        {
+            --self->tag[pool->tags[item]].num_elements;
+            self->tag[pool->tags[item]].num_bytes -= pool->element_size;
+        }
+    }
+    else if ( self->low_level_free_function )
+    {
+        __atomic_add_fetch( &self->diag_num_frees_from_heap, 1, __ATOMIC_RELAXED );
+        self->low_level_free_function( p );
     }
 }
 
+static void Pools_deallocate_remote( struct Pools *self, void *p )
+{
+    struct Pool copy;
+    int in_pool;
+    Pools_layout_reader_enter( self );
+    in_pool = Pools_copy_pool_for_address( self, p, &copy );
+    /* the profile is only touched by the owner, so while it is running heap spills are handed back like pool elements */
+    if ( in_pool || __atomic_load_n( &self->profile.sites, __ATOMIC_RELAXED ) )
+    {
+        /* an element that is pushed twice would make the list a cycle, so a second free is caught before the push */
+        if ( !in_pool || Pool_mark_element_remote_free( &copy, (size_t)Pool_get_element_for_address( &copy, p ) ) == 0 )
+        {
+            void *head = __atomic_load_n( &self->remote_free_head, __ATOMIC_RELAXED );
+            __atomic_add_fetch( &self->diag_num_remote_frees, 1, __ATOMIC_RELAXED );
+            do
+            {
+                *(void **)p = head;
+            } while ( !__atomic_compare_exchange_n(
+                &self->remote_free_head, &head, p, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+        }
+    }
+    else if ( self->low_level_free_function )
+    {
+        __atomic_add_fetch( &self->diag_num_frees_from_heap, 1, __ATOMIC_RELAXED );
+        self->low_level_free_function( p );
+    }
+    Pools_layout_reader_exit( self );
+}
+
+void Pools_deallocate_element( struct Pools *self, void *p )
+{
+    if ( p )
+    {
+        if ( self->trace.header )
+        {
+            Pools_trace_record( &self->trace, POOLS_TRACE_DEALLOCATE, 0, p );
+        }
+        if ( Pools_is_owner( self ) )
+        {
+            Pools_deallocate_local( self, p );
+        }
+        else
+        {
+            Pools_deallocate_remote( self, p );
+        }
+    }
+}
+
+void *Pools_reallocate( struct Pools *self, void *p, size_t old_size, size_t new_size )
+{
+    void *r = 0;
+    struct Pool *pool;
+    if ( p == 0 )
+    {
+        return Pools_allocate_element( self, new_size );
+    }
+    if ( new_size == 0 )
+    {
+        Pools_deallocate_element( self, p );
+        return 0;
+    }
+    pool = Pools_find_pool_for_address( self, p );
+    if ( pool && new_size <= pool->element_size )
+    {
+        ++self->diag_num_reallocs_in_place;
+        r = p;
+        /* recorded as a free and an allocation of the new size at the same address, so that a replay resizes the item */
+        if ( self->trace.header )
+        {
+            Pools_trace_record( &self->trace, POOLS_TRACE_DEALLOCATE, 0, p );
+            Pools_trace_record( &self->trace, POOLS_TRACE_ALLOCATE, new_size, p );
+        }
+    }
+    else if ( !pool && self->low_level_reallocation_function )
+    {
+        r = self->low_level_reallocation_function( p, new_size < sizeof( void * ) ? sizeof( void * ) : new_size );
+        if ( r )
+        {
+            ++self->diag_num_reallocs_moved;
+        }
+        if ( self->trace.header && r )
+        {
+            Pools_trace_record( &self->trace, POOLS_TRACE_DEALLOCATE, 0, p );
+            Pools_trace_record( &self->trace, POOLS_TRACE_ALLOCATE, new_size, r );
+        }
+        if ( self->profile.num_live && r )
+        {
+            Pools_profile_record_deallocation( &self->profile, p );
+        }
+    }
+    else
+    {
+        size_t bytes_to_copy = old_size < new_size ? old_size : new_size;
+        if ( pool && bytes_to_copy > pool->element_size )
+        {
+            bytes_to_copy = pool->element_size;
+        }
+        /* a moved pool element stays charged to its tag; heap items are not tagged */
+        r = pool && pool->tags ? Pools_allocate_tagged( self, new_size, pool->tags[Pool_get_element_for_address( pool, p )] )
+                               : Pools_allocate_element( self, new_size );
+        if ( r )
+        {
+            ++self->diag_num_reallocs_moved;
+            memcpy( r, p, bytes_to_copy );
+            Pools_deallocate_element( self, p );
+        }
+    }
+    return r;
+}
+
+int Pools_trace_start( struct Pools *self, const char *path, size_t capacity )
+{
+    struct Pools_trace trace;
+    int r = Pools_trace_open( &trace, path, capacity );
+    if ( r == 0 )
+    {
+        Pools_trace_stop( self );
+        self->trace = trace;
+    }
+    return r;
+}
+
+void Pools_trace_stop( struct Pools *self )
+{
+    if ( self->trace.header )
+    {
+        Pools_trace_close( &self->trace );
+    }
+}
+
+int Pools_profile_start( struct Pools *self, size_t sample_interval, size_t max_sites, size_t max_live )
+{
+    struct Pools_profile profile;
+    int r = Pools_profile_open( &profile, sample_interval, max_sites, max_live );
+    if ( r == 0 )
+    {
+        Pools_profile_stop( self );
+        self->profile = profile;
+    }
+    return r;
+}
+
+void Pools_profile_stop( struct Pools *self )
+{
+    if ( self->profile.sites )
+    {
+        Pools_profile_close( &self->profile );
+    }
+}
+
+size_t Pools_drain_remote_frees( struct Pools *self )
+{
+    size_t count = 0;
+    size_t limit;
+    void *p;
+    p = __atomic_exchange_n( &self->remote_free_head, 0, __ATOMIC_ACQUIRE );
+    /* every push was counted before it was published, so the list holds at most this many elements */
+    limit = __atomic_load_n( &self->diag_num_remote_frees, __ATOMIC_RELAXED ) - self->num_remote_frees_drained;
+    if ( p )
+    {
+        ++self->diag_num_remote_drains;
+    }
+    while ( p )
+    {
+        void *next = *(void **)p;
+        if ( count == limit )
+        {
+            POOL_ABORT( "Remote free list has a cycle" );
+            break;
+        }
+        Pools_deallocate_local( self, p );
+        ++count;
+        p = next;
+    }
+    self->num_remote_frees_drained += count;
+    return count;
+}
+
 #if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
 void Pools_diagnostics( struct Pools *self, const char *prefix, int ( *print )( const char * ) )
 {
@@ -135,6 +939,10 @@ void Pools_diagnostics( struct Pools *self, const char *prefix, int ( *print )(
         total_items_still_allocated += self->pool[i].total_allocated_items;
     }
     char buf[128];
+    sprintf( buf, "%s:summary:numa_node                   :%d", prefix, self->numa_node );
+    print( buf );
+    sprintf( buf, "%s:summary:diag_num_bind_failures      :%zu", prefix, self->diag_num_bind_failures );
+    print( buf );
     sprintf( buf, "%s:summary:total_items_still_allocated :%zu", prefix, total_items_still_allocated );
     print( buf );
     sprintf( buf, "%s:summary:diag_num_frees_from_heap    :%zu", prefix, self->diag_num_frees_from_heap );
@@ -143,6 +951,51 @@ void Pools_diagnostics( struct Pools *self, const char *prefix, int ( *print )(
     print( buf );
     sprintf( buf, "%s:summary:diag_num_spills_to_heap     :%zu", prefix, self->diag_num_spills_to_heap );
     print( buf );
+    sprintf( buf, "%s:summary:diag_num_reallocs_in_place  :%zu", prefix, self->diag_num_reallocs_in_place );
+    print( buf );
+    sprintf( buf, "%s:summary:diag_num_reallocs_moved     :%zu", prefix, self->diag_num_reallocs_moved );
+    print( buf );
+    sprintf( buf, "%s:summary:diag_num_remote_frees       :%zu", prefix, self->diag_num_remote_frees );
+    print( buf );
+    sprintf( buf, "%s:summary:diag_num_remote_drains      :%zu", prefix, self->diag_num_remote_drains );
+    print( buf );
+    for ( i = 0; self->tagging && i < POOLS_MAX_TAGS; ++i )
+    {
+        struct Pools_tag *t = &self->tag[i];
+        if ( t->num_elements || t->max_bytes || t->max_elements || t->diag_num_over_budget )
+        {
+            sprintf( buf, "%s:tag_%02zu:num_elements                 :%zu", prefix, i, t->num_elements );
+            print( buf );
+            sprintf( buf, "%s:tag_%02zu:num_bytes                    :%zu", prefix, i, t->num_bytes );
+            print( buf );
+            sprintf( buf, "%s:tag_%02zu:max_elements                 :%zu", prefix, i, t->max_elements );
+            print( buf );
+            sprintf( buf, "%s:tag_%02zu:max_bytes                    :%zu", prefix, i, t->max_bytes );
+            print( buf );
+            sprintf( buf, "%s:tag_%02zu:diag_num_over_budget         :%zu", prefix, i, t->diag_num_over_budget );
+            print( buf );
+        }
+    }
+    if ( self->epoch.threads )
+    {
+        sprintf( buf, "%s:summary:diag_num_epoch_retired      :%zu", prefix, self->epoch.diag_num_retired );
+        print( buf );
+        sprintf( buf, "%s:summary:diag_num_epoch_reclaimed    :%zu", prefix, self->epoch.diag_num_reclaimed );
+        print( buf );
+        sprintf( buf, "%s:summary:diag_num_epoch_advances     :%zu", prefix, self->epoch.diag_num_advances );
+        print( buf );
+    }
+    if ( self->profile.sites )
+    {
+        sprintf( buf, "%s:summary:profile_num_sites           :%zu", prefix, self->profile.num_sites );
+        print( buf );
+        sprintf( buf, "%s:summary:profile_num_live_samples    :%zu", prefix, self->profile.num_live );
+        print( buf );
+        sprintf( buf, "%s:summary:diag_num_profile_samples    :%zu", prefix, self->profile.diag_num_samples );
+        print( buf );
+        sprintf( buf, "%s:summary:diag_num_profile_dropped    :%zu", prefix, self->profile.diag_num_dropped_samples );
+        print( buf );
+    }
     print( "" );
 }
 
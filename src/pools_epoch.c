@@ -0,0 +1,203 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include "pools.h"
+
+static void Pools_epoch_free_bag( struct Pools *self, struct Pools_epoch_bag *bag )
+{
+    size_t i;
+    for ( i = 0; i < bag->count; ++i )
+    {
+        Pools_deallocate_element( self, bag->items[i] );
+    }
+    __atomic_fetch_add( &self->epoch.diag_num_reclaimed, bag->count, __ATOMIC_RELAXED );
+    bag->count = 0;
+}
+
+/**
+ * @brief Pools_epoch_try_advance  Advance the global epoch if every thread inside a critical section has seen it
+ * @param self                     Pointer to Pools struct
+ * @return                         The global epoch after the attempt
+ */
+static uint64_t Pools_epoch_try_advance( struct Pools *self )
+{
+    uint64_t r = __atomic_load_n( &self->epoch.global_epoch, __ATOMIC_SEQ_CST );
+    struct Pools_epoch_thread *thread;
+    for ( thread = __atomic_load_n( &self->epoch.threads, __ATOMIC_ACQUIRE ); thread != 0; thread = thread->next )
+    {
+        uint64_t state = __atomic_load_n( &thread->state, __ATOMIC_SEQ_CST );
+        if ( ( state & 1 ) && ( state >> 1 ) != r )
+        {
+            return r;
+        }
+    }
+    if ( __atomic_compare_exchange_n( &self->epoch.global_epoch, &r, r + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+    {
+        __atomic_fetch_add( &self->epoch.diag_num_advances, 1, __ATOMIC_RELAXED );
+        ++r;
+    }
+    return r;
+}
+
+struct Pools_epoch_thread *Pools_epoch_register( struct Pools *self )
+{
+    struct Pools_epoch_thread *r;
+    for ( r = __atomic_load_n( &self->epoch.threads, __ATOMIC_ACQUIRE ); r != 0; r = r->next )
+    {
+        int expected = 0;
+        if ( __atomic_compare_exchange_n( &r->in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        {
+            return r;
+        }
+    }
+    if ( self->low_level_allocation_function == 0 )
+    {
+        return 0;
+    }
+    r = self->low_level_allocation_function( sizeof( struct Pools_epoch_thread ) );
+    if ( r != 0 )
+    {
+        memset( r, 0, sizeof( *r ) );
+        r->in_use = 1;
+        r->next = __atomic_load_n( &self->epoch.threads, __ATOMIC_RELAXED );
+        while ( !__atomic_compare_exchange_n( &self->epoch.threads, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+        {
+        }
+    }
+    return r;
+}
+
+void Pools_epoch_unregister( struct Pools *self, struct Pools_epoch_thread *thread )
+{
+    if ( thread->nesting != 0 )
+    {
+        POOL_ABORT( "Pools_epoch_unregister inside a critical section" );
+    }
+    Pools_epoch_reclaim( self, thread );
+    __atomic_store_n( &thread->in_use, 0, __ATOMIC_RELEASE );
+}
+
+void Pools_epoch_enter( struct Pools *self, struct Pools_epoch_thread *thread )
+{
+    if ( thread->nesting++ == 0 )
+    {
+        uint64_t epoch = __atomic_load_n( &self->epoch.global_epoch, __ATOMIC_RELAXED );
+        __atomic_store_n( &thread->state, ( epoch << 1 ) | 1, __ATOMIC_RELAXED );
+        /* The announcement has to be visible before any shared pointer is read */
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    }
+}
+
+void Pools_epoch_exit( struct Pools *self, struct Pools_epoch_thread *thread )
+{
+    (void)self;
+    if ( --thread->nesting == 0 )
+    {
+        __atomic_store_n( &thread->state, 0, __ATOMIC_RELEASE );
+    }
+}
+
+int Pools_retire( struct Pools *self, struct Pools_epoch_thread *thread, void *p )
+{
+    int r = -1;
+    uint64_t epoch = __atomic_load_n( &self->epoch.global_epoch, __ATOMIC_SEQ_CST );
+    struct Pools_epoch_bag *bag = &thread->bag[epoch % 3];
+    if ( bag->epoch != epoch )
+    {
+        /* The bag still holds items from at least three epochs ago */
+        Pools_epoch_free_bag( self, bag );
+        bag->epoch = epoch;
+    }
+    if ( bag->count == bag->capacity )
+    {
+        size_t capacity = bag->capacity ? bag->capacity * 2 : POOLS_EPOCH_RECLAIM_INTERVAL;
+        void **items = 0;
+        if ( self->low_level_allocation_function )
+        {
+            items = self->low_level_allocation_function( capacity * sizeof( void * ) );
+        }
+        if ( items == 0 )
+        {
+            return r;
+        }
+        if ( bag->items )
+        {
+            memcpy( items, bag->items, bag->count * sizeof( void * ) );
+            self->low_level_free_function( bag->items );
+        }
+        bag->items = items;
+        bag->capacity = capacity;
+    }
+    bag->items[bag->count++] = p;
+    __atomic_fetch_add( &self->epoch.diag_num_retired, 1, __ATOMIC_RELAXED );
+    if ( ++thread->retires_since_reclaim >= POOLS_EPOCH_RECLAIM_INTERVAL )
+    {
+        Pools_epoch_reclaim( self, thread );
+    }
+    r = 0;
+    return r;
+}
+
+size_t Pools_epoch_reclaim( struct Pools *self, struct Pools_epoch_thread *thread )
+{
+    size_t r = 0;
+    size_t i;
+    uint64_t epoch = Pools_epoch_try_advance( self );
+    thread->retires_since_reclaim = 0;
+    for ( i = 0; i < 3; ++i )
+    {
+        struct Pools_epoch_bag *bag = &thread->bag[i];
+        if ( bag->count != 0 && bag->epoch + 2 <= epoch )
+        {
+            r += bag->count;
+            Pools_epoch_free_bag( self, bag );
+        }
+    }
+    return r;
+}
+
+void Pools_epoch_terminate( struct Pools *self )
+{
+    struct Pools_epoch_thread *thread = self->epoch.threads;
+    while ( thread != 0 )
+    {
+        struct Pools_epoch_thread *next = thread->next;
+        size_t i;
+        for ( i = 0; i < 3; ++i )
+        {
+            Pools_epoch_free_bag( self, &thread->bag[i] );
+            if ( thread->bag[i].items )
+            {
+                self->low_level_free_function( thread->bag[i].items );
+            }
+        }
+        self->low_level_free_function( thread );
+        thread = next;
+    }
+    self->epoch.threads = 0;
+}
@@ -0,0 +1,490 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <time.h>
+#include <unistd.h>
+#include "pools_maintainer.h"
+
+/**
+ * @brief PoolsMaintainer_class The occupancy of all pools of one element size
+ */
+struct PoolsMaintainer_class
+{
+    size_t element_size;
+    size_t number_of_elements;
+    enum Pool_placement_policy placement_policy;
+    size_t capacity;
+    size_t allocated;
+};
+
+static size_t PoolsMaintainer_collect_classes( struct Pool *pools, size_t num_pools, struct PoolsMaintainer_class *classes )
+{
+    size_t num_classes = 0;
+    size_t i;
+    size_t c;
+    for ( i = 0; i < num_pools; ++i )
+    {
+        struct Pool *pool = &pools[i];
+        for ( c = 0; c < num_classes && classes[c].element_size != pool->element_size; ++c )
+        {
+        }
+        if ( c == num_classes )
+        {
+            /* grown pools copy the size and policy of the first pool of their class */
+            classes[c].element_size = pool->element_size;
+            classes[c].number_of_elements = pool->num_elements;
+            classes[c].placement_policy = pool->placement_policy;
+            classes[c].capacity = 0;
+            classes[c].allocated = 0;
+            ++num_classes;
+        }
+        classes[c].capacity += pool->num_elements;
+        classes[c].allocated += pool->total_allocated_items;
+    }
+    return num_classes;
+}
+
+static int PoolsMaintainer_is_above_watermark( struct PoolsMaintainer *self, size_t allocated, size_t capacity )
+{
+    return allocated * 100 >= capacity * self->grow_watermark_percent;
+}
+
+/**
+ * @brief PoolsMaintainer_prefault Write one byte of every page of a new pool's storage, so that the page faults are taken
+ * by the maintainer rather than by the owner's first allocations. Storage that Pool_init cleared is already resident, but
+ * storage from a zeroed low level allocation function is usually not.
+ */
+static void PoolsMaintainer_prefault( struct Pool *pool )
+{
+    volatile unsigned char *storage = pool->element_storage;
+    long page_size = sysconf( _SC_PAGESIZE );
+    size_t offset;
+    if ( storage && page_size > 0 )
+    {
+        /* the bytes are written back unchanged; a read alone could be served by the shared zero page */
+        for ( offset = 0; offset < pool->element_storage_size; offset += (size_t)page_size )
+        {
+            storage[offset] = storage[offset];
+        }
+    }
+}
+
+static void PoolsMaintainer_grow( struct PoolsMaintainer *self )
+{
+    struct Pools *pools = self->pools;
+    struct Pool layout[POOLS_MAX_POOLS];
+    struct PoolsMaintainer_class classes[POOLS_MAX_POOLS];
+    size_t num_pools = Pools_copy_layout( pools, layout );
+    size_t num_classes;
+    size_t num_free_slots;
+    size_t c;
+    size_t i;
+
+    /* pools that are ready but not yet inserted already count towards their class */
+    pthread_mutex_lock( &self->lock );
+    num_classes = PoolsMaintainer_collect_classes( layout, num_pools, classes );
+    for ( i = 0; i < self->num_ready; ++i )
+    {
+        for ( c = 0; c < num_classes && classes[c].element_size != self->ready_pool[i].element_size; ++c )
+        {
+        }
+        if ( c < num_classes )
+        {
+            classes[c].capacity += self->ready_pool[i].num_elements;
+        }
+    }
+    num_free_slots = POOLS_MAX_POOLS - num_pools > self->num_ready ? POOLS_MAX_POOLS - num_pools - self->num_ready : 0;
+    pthread_mutex_unlock( &self->lock );
+
+    for ( c = 0; c < num_classes; ++c )
+    {
+        struct Pool pool;
+        if ( classes[c].capacity == 0 || !PoolsMaintainer_is_above_watermark( self, classes[c].allocated, classes[c].capacity ) )
+        {
+            continue;
+        }
+        if ( num_free_slots == 0 )
+        {
+            pthread_mutex_lock( &self->lock );
+            ++self->diag_num_grow_failures;
+            pthread_mutex_unlock( &self->lock );
+            continue;
+        }
+        if ( Pools_init_pool( pools, &pool, classes[c].element_size, classes[c].number_of_elements ) != 0 )
+        {
+            pthread_mutex_lock( &self->lock );
+            ++self->diag_num_grow_failures;
+            self->low_memory_pending = 1;
+            pthread_mutex_unlock( &self->lock );
+            continue;
+        }
+        Pool_set_placement_policy( &pool, classes[c].placement_policy );
+        PoolsMaintainer_prefault( &pool );
+
+        pthread_mutex_lock( &self->lock );
+        self->ready_pool[self->num_ready++] = pool;
+        __atomic_store_n( &self->work_pending, 1, __ATOMIC_RELAXED );
+        pthread_mutex_unlock( &self->lock );
+        --num_free_slots;
+    }
+}
+
+static void PoolsMaintainer_trim( struct PoolsMaintainer *self, int low_memory )
+{
+    struct Pools *pools = self->pools;
+    struct Pool layout[POOLS_MAX_POOLS];
+    struct PoolsMaintainer_class classes[POOLS_MAX_POOLS];
+    size_t num_pools = Pools_copy_layout( pools, layout );
+    size_t num_classes = PoolsMaintainer_collect_classes( layout, num_pools, classes );
+    size_t g;
+    size_t i;
+    size_t c;
+
+    pthread_mutex_lock( &self->lock );
+    for ( g = 0; g < self->num_grown; ++g )
+    {
+        struct Pool *pool = 0;
+        for ( i = 0; i < num_pools; ++i )
+        {
+            if ( layout[i].element_storage == self->grown_storage[g] )
+            {
+                pool = &layout[i];
+                break;
+            }
+        }
+        if ( pool && pool->total_allocated_items == 0 )
+        {
+            ++self->grown_idle_passes[g];
+        }
+        else
+        {
+            self->grown_idle_passes[g] = 0;
+        }
+        if ( !pool || pool->total_allocated_items != 0
+             || ( !low_memory && self->grown_idle_passes[g] < self->trim_idle_passes ) )
+        {
+            continue;
+        }
+        for ( i = 0; i < self->num_trim_requests && self->trim_request[i] != pool->element_storage; ++i )
+        {
+        }
+        if ( i < self->num_trim_requests )
+        {
+            continue;
+        }
+        /* keep the pool if releasing it would push its class straight back over the grow watermark */
+        for ( c = 0; c < num_classes && classes[c].element_size != pool->element_size; ++c )
+        {
+        }
+        if ( !low_memory
+             && PoolsMaintainer_is_above_watermark( self, classes[c].allocated, classes[c].capacity - pool->num_elements ) )
+        {
+            continue;
+        }
+        classes[c].capacity -= pool->num_elements;
+        self->trim_request[self->num_trim_requests++] = pool->element_storage;
+        __atomic_store_n( &self->work_pending, 1, __ATOMIC_RELAXED );
+    }
+    pthread_mutex_unlock( &self->lock );
+}
+
+/**
+ * @brief PoolsMaintainer_release_retired Terminate the retired pools once no other thread can still be using a copy of them
+ */
+static void PoolsMaintainer_release_retired( struct PoolsMaintainer *self )
+{
+    struct Pool retired[POOLS_MAINTAINER_MAX_RETIRED];
+    size_t num_retired = 0;
+    size_t i;
+
+    pthread_mutex_lock( &self->lock );
+    /* the pools were removed before the owner released the lock, so a thread that starts looking up pools after this
+     * point can no longer find them */
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( self->num_retired > 0 && __atomic_load_n( &self->pools->num_layout_readers, __ATOMIC_SEQ_CST ) == 0 )
+    {
+        num_retired = self->num_retired;
+        memcpy( retired, self->retired_pool, num_retired * sizeof( struct Pool ) );
+        self->num_retired = 0;
+    }
+    pthread_mutex_unlock( &self->lock );
+
+    for ( i = 0; i < num_retired; ++i )
+    {
+        Pool_terminate( &retired[i] );
+    }
+}
+
+void PoolsMaintainer_apply( struct PoolsMaintainer *self )
+{
+    struct Pools *pools = self->pools;
+    size_t num_kept;
+    size_t i;
+    size_t j;
+    size_t g;
+
+    if ( pthread_mutex_trylock( &self->lock ) == 0 )
+    {
+        /* a pool that would have to be retired while retired_pool is full stays pending until the retired pools are
+         * released */
+        num_kept = 0;
+        for ( i = 0; i < self->num_ready; ++i )
+        {
+            if ( Pools_insert_pool( pools, &self->ready_pool[i] ) == 0 )
+            {
+                self->grown_storage[self->num_grown] = self->ready_pool[i].element_storage;
+                self->grown_idle_passes[self->num_grown] = 0;
+                ++self->num_grown;
+                ++self->diag_num_grows;
+            }
+            else if ( self->num_retired < POOLS_MAINTAINER_MAX_RETIRED )
+            {
+                self->retired_pool[self->num_retired++] = self->ready_pool[i];
+                ++self->diag_num_grow_failures;
+            }
+            else
+            {
+                self->ready_pool[num_kept++] = self->ready_pool[i];
+            }
+        }
+        self->num_ready = num_kept;
+
+        num_kept = 0;
+        for ( i = 0; i < self->num_trim_requests; ++i )
+        {
+            for ( j = 0; j < pools->num_pools && pools->pool[j].element_storage != self->trim_request[i]; ++j )
+            {
+            }
+            /* the owner may have allocated from the pool since the maintainer saw it empty */
+            if ( j == pools->num_pools || pools->pool[j].total_allocated_items != 0 )
+            {
+                continue;
+            }
+            if ( self->num_retired == POOLS_MAINTAINER_MAX_RETIRED )
+            {
+                self->trim_request[num_kept++] = self->trim_request[i];
+                continue;
+            }
+            Pools_remove_pool( pools, j, &self->retired_pool[self->num_retired++] );
+            for ( g = 0; g < self->num_grown && self->grown_storage[g] != self->trim_request[i]; ++g )
+            {
+            }
+            for ( ; g + 1 < self->num_grown; ++g )
+            {
+                self->grown_storage[g] = self->grown_storage[g + 1];
+                self->grown_idle_passes[g] = self->grown_idle_passes[g + 1];
+            }
+            --self->num_grown;
+            ++self->diag_num_trims;
+        }
+        self->num_trim_requests = num_kept;
+        __atomic_store_n( &self->work_pending, self->num_ready > 0 || self->num_trim_requests > 0, __ATOMIC_RELAXED );
+        pthread_mutex_unlock( &self->lock );
+    }
+}
+
+void PoolsMaintainer_run_once( struct PoolsMaintainer *self )
+{
+    int low_memory;
+    size_t i;
+
+    pthread_mutex_lock( &self->lock );
+    ++self->diag_num_passes;
+    low_memory = self->low_memory_pending;
+    self->low_memory_pending = 0;
+    pthread_mutex_unlock( &self->lock );
+
+    PoolsMaintainer_trim( self, low_memory );
+    if ( low_memory )
+    {
+        /* callbacks run without the lock so that they may free items back to the Pools */
+        ++self->diag_num_low_memory_events;
+        for ( i = 0; i < self->num_low_memory_callbacks; ++i )
+        {
+            self->low_memory_callback[i].callback( self->low_memory_callback[i].context, self->pools );
+        }
+    }
+    else
+    {
+        PoolsMaintainer_grow( self );
+    }
+    if ( __atomic_load_n( &self->pools->owner_thread, __ATOMIC_RELAXED ) == Pools_current_thread() )
+    {
+        PoolsMaintainer_apply( self );
+    }
+    PoolsMaintainer_release_retired( self );
+}
+
+static void *PoolsMaintainer_thread( void *arg )
+{
+    struct PoolsMaintainer *self = (struct PoolsMaintainer *)arg;
+    pthread_mutex_lock( &self->lock );
+    while ( !self->stop_requested )
+    {
+        struct timespec deadline;
+        pthread_mutex_unlock( &self->lock );
+        PoolsMaintainer_run_once( self );
+        pthread_mutex_lock( &self->lock );
+
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += self->interval_ms / 1000;
+        deadline.tv_nsec += (long)( self->interval_ms % 1000 ) * 1000000L;
+        if ( deadline.tv_nsec >= 1000000000L )
+        {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while ( !self->stop_requested && !self->low_memory_pending
+                && pthread_cond_timedwait( &self->wakeup, &self->lock, &deadline ) == 0 )
+        {
+        }
+    }
+    pthread_mutex_unlock( &self->lock );
+    return 0;
+}
+
+int PoolsMaintainer_init( struct PoolsMaintainer *self,
+                          struct Pools *pools,
+                          unsigned interval_ms,
+                          unsigned grow_watermark_percent,
+                          unsigned trim_idle_passes )
+{
+    int r = -1;
+    memset( self, 0, sizeof( *self ) );
+    if ( pools->maintainer == 0 && grow_watermark_percent > 0 && grow_watermark_percent <= 100 )
+    {
+        self->pools = pools;
+        self->interval_ms = interval_ms;
+        self->grow_watermark_percent = grow_watermark_percent;
+        self->trim_idle_passes = trim_idle_passes;
+        pthread_mutex_init( &self->lock, 0 );
+        pthread_cond_init( &self->wakeup, 0 );
+        pools->maintainer = self;
+        r = 0;
+    }
+    return r;
+}
+
+void PoolsMaintainer_terminate( struct PoolsMaintainer *self )
+{
+    size_t i;
+    if ( self->pools )
+    {
+        PoolsMaintainer_stop( self );
+        /* nothing else is using the Pools now, so work that was never applied is dropped */
+        for ( i = 0; i < self->num_ready; ++i )
+        {
+            Pool_terminate( &self->ready_pool[i] );
+        }
+        for ( i = 0; i < self->num_retired; ++i )
+        {
+            Pool_terminate( &self->retired_pool[i] );
+        }
+        self->num_ready = 0;
+        self->num_retired = 0;
+        self->num_trim_requests = 0;
+        self->pools->maintainer = 0;
+        self->pools = 0;
+        pthread_cond_destroy( &self->wakeup );
+        pthread_mutex_destroy( &self->lock );
+    }
+}
+
+int PoolsMaintainer_start( struct PoolsMaintainer *self )
+{
+    int r = -1;
+    if ( !self->running )
+    {
+        self->stop_requested = 0;
+        if ( pthread_create( &self->thread, 0, PoolsMaintainer_thread, self ) == 0 )
+        {
+            self->running = 1;
+            r = 0;
+        }
+    }
+    return r;
+}
+
+void PoolsMaintainer_stop( struct PoolsMaintainer *self )
+{
+    if ( self->running )
+    {
+        pthread_mutex_lock( &self->lock );
+        self->stop_requested = 1;
+        pthread_cond_signal( &self->wakeup );
+        pthread_mutex_unlock( &self->lock );
+        pthread_join( self->thread, 0 );
+        self->running = 0;
+    }
+}
+
+int PoolsMaintainer_add_low_memory_callback( struct PoolsMaintainer *self,
+                                             void ( *callback )( void *context, struct Pools *pools ),
+                                             void *context )
+{
+    int r = -1;
+    pthread_mutex_lock( &self->lock );
+    if ( self->num_low_memory_callbacks < POOLS_MAINTAINER_MAX_CALLBACKS )
+    {
+        self->low_memory_callback[self->num_low_memory_callbacks].callback = callback;
+        self->low_memory_callback[self->num_low_memory_callbacks].context = context;
+        ++self->num_low_memory_callbacks;
+        r = 0;
+    }
+    pthread_mutex_unlock( &self->lock );
+    return r;
+}
+
+void PoolsMaintainer_notify_low_memory( struct PoolsMaintainer *self )
+{
+    pthread_mutex_lock( &self->lock );
+    self->low_memory_pending = 1;
+    pthread_cond_signal( &self->wakeup );
+    pthread_mutex_unlock( &self->lock );
+}
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+void PoolsMaintainer_diagnostics( struct PoolsMaintainer *self, const char *prefix, int ( *print )( const char * ) )
+{
+    char buf[128];
+    pthread_mutex_lock( &self->lock );
+    sprintf( buf, "%s:maintainer:num_grown                 :%zu", prefix, self->num_grown );
+    print( buf );
+    sprintf( buf, "%s:maintainer:diag_num_passes           :%zu", prefix, self->diag_num_passes );
+    print( buf );
+    sprintf( buf, "%s:maintainer:diag_num_grows            :%zu", prefix, self->diag_num_grows );
+    print( buf );
+    sprintf( buf, "%s:maintainer:diag_num_grow_failures    :%zu", prefix, self->diag_num_grow_failures );
+    print( buf );
+    sprintf( buf, "%s:maintainer:diag_num_trims            :%zu", prefix, self->diag_num_trims );
+    print( buf );
+    sprintf( buf, "%s:maintainer:diag_num_low_memory_events:%zu", prefix, self->diag_num_low_memory_events );
+    print( buf );
+    pthread_mutex_unlock( &self->lock );
+    print( "" );
+}
+#endif
@@ -0,0 +1,435 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include "pools_numa.h"
+
+#if defined( __linux__ )
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND ( 2 )
+#endif
+
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE ( 1 << 1 )
+#endif
+
+static size_t PoolsNuma_count_online_nodes( void )
+{
+    size_t r = 1;
+    FILE *f = fopen( "/sys/devices/system/node/online", "r" );
+    if ( f )
+    {
+        /* the file holds a list of ranges like "0" or "0-1" or "0,2-3"; the highest node number determines the count */
+        char buf[128];
+        if ( fgets( buf, sizeof( buf ), f ) )
+        {
+            const char *s = buf;
+            size_t highest = 0;
+            while ( *s )
+            {
+                char *end = 0;
+                unsigned long n = strtoul( s, &end, 10 );
+                if ( end == s )
+                {
+                    ++s;
+                }
+                else
+                {
+                    if ( n > highest )
+                    {
+                        highest = n;
+                    }
+                    s = end;
+                }
+            }
+            r = highest + 1;
+        }
+        fclose( f );
+    }
+    if ( r > POOLS_NUMA_MAX_NODES )
+    {
+        r = POOLS_NUMA_MAX_NODES;
+    }
+    return r;
+}
+
+int Pool_bind_to_numa_node( struct Pool *self, int node )
+{
+    int r = -1;
+    long page_size = sysconf( _SC_PAGESIZE );
+    if ( self->element_storage && page_size > 0 && node >= 0 && node < (int)( sizeof( unsigned long ) * 8 ) )
+    {
+        uintptr_t first = ( (uintptr_t)self->element_storage + page_size - 1 ) & ~(uintptr_t)( page_size - 1 );
+        uintptr_t last = ( (uintptr_t)self->element_storage + self->element_storage_size ) & ~(uintptr_t)( page_size - 1 );
+        if ( first < last )
+        {
+            unsigned long nodemask = 1UL << node;
+            if ( syscall( SYS_mbind,
+                          (void *)first,
+                          (unsigned long)( last - first ),
+                          MPOL_BIND,
+                          &nodemask,
+                          sizeof( nodemask ) * 8,
+                          MPOL_MF_MOVE ) == 0 )
+            {
+                r = 0;
+            }
+        }
+    }
+    return r;
+}
+
+size_t PoolsNuma_current_node( struct PoolsNuma *self )
+{
+    size_t r = 0;
+    if ( self->num_nodes > 1 )
+    {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if ( syscall( SYS_getcpu, &cpu, &node, 0 ) == 0 && node < self->num_nodes )
+        {
+            r = node;
+        }
+    }
+    return r;
+}
+
+#else
+
+static size_t PoolsNuma_count_online_nodes( void ) { return 1; }
+
+int Pool_bind_to_numa_node( struct Pool *self, int node )
+{
+    (void)self;
+    (void)node;
+    return -1;
+}
+
+size_t PoolsNuma_current_node( struct PoolsNuma *self )
+{
+    (void)self;
+    return 0;
+}
+
+#endif
+
+/* no thread's Pools_current_thread(), so that every free to a detached Pools goes through its remote free list */
+static const char PoolsNuma_detached_token = 0;
+
+/* the PoolsNuma the calling thread is attached to, and the slot of its Pools there */
+static __thread struct PoolsNuma *PoolsNuma_attached_numa = 0;
+static __thread size_t PoolsNuma_attached_slot = 0;
+
+int PoolsNuma_init( struct PoolsNuma *self,
+                    const char *name,
+                    void *( *low_level_allocation_function )( size_t ),
+                    void ( *low_level_free_function )( void * ) )
+{
+    int r = 0;
+    size_t n;
+    self->name = name;
+    self->num_nodes = PoolsNuma_count_online_nodes();
+    self->diag_num_bind_failures = 0;
+    self->num_classes = 0;
+    self->num_thread_slots = 0;
+    memset( self->thread_state, 0, sizeof( self->thread_state ) );
+    for ( n = 0; n < self->num_nodes; ++n )
+    {
+        if ( Pools_init( &self->node[n], name, low_level_allocation_function, low_level_free_function ) != 0 )
+        {
+            r = -1;
+        }
+        /* every node's Pools is shared by all threads on that node under node_lock, so none of them has an owner */
+        self->node[n].owner_thread = 0;
+        if ( self->num_nodes > 1 )
+        {
+            self->node[n].numa_node = (int)n;
+        }
+        pthread_mutex_init( &self->node_lock[n], 0 );
+    }
+    return r;
+}
+
+int PoolsNuma_add( struct PoolsNuma *self, size_t element_size, size_t number_of_elements )
+{
+    int r = 0;
+    size_t n;
+    for ( n = 0; n < self->num_nodes && r == 0; ++n )
+    {
+        struct Pools *pools = &self->node[n];
+        size_t bind_failures = pools->diag_num_bind_failures;
+        /* the storage is bound to the node of the Pools before it is first written */
+        r = Pools_add( pools, element_size, number_of_elements );
+        self->diag_num_bind_failures += pools->diag_num_bind_failures - bind_failures;
+    }
+    if ( r == 0 && self->num_classes < POOLS_MAX_POOLS )
+    {
+        self->class_element_size[self->num_classes] = element_size;
+        self->class_number_of_elements[self->num_classes] = number_of_elements;
+        ++self->num_classes;
+    }
+    return r;
+}
+
+static int PoolsNuma_init_thread_pools( struct PoolsNuma *self, struct Pools *pools, size_t node )
+{
+    int r = Pools_init( pools, self->name, self->node[0].low_level_allocation_function, self->node[0].low_level_free_function );
+    size_t c;
+    if ( self->num_nodes > 1 )
+    {
+        pools->numa_node = (int)node;
+    }
+    for ( c = 0; c < self->num_classes && r == 0; ++c )
+    {
+        r = Pools_add( pools, self->class_element_size[c], self->class_number_of_elements[c] );
+    }
+    __atomic_add_fetch( &self->diag_num_bind_failures, pools->diag_num_bind_failures, __ATOMIC_RELAXED );
+    if ( r != 0 )
+    {
+        Pools_terminate( pools );
+    }
+    return r;
+}
+
+int PoolsNuma_attach_thread( struct PoolsNuma *self )
+{
+    int r = -1;
+    size_t node = PoolsNuma_current_node( self );
+    int numa_node = self->num_nodes > 1 ? (int)node : -1;
+    size_t num_slots = __atomic_load_n( &self->num_thread_slots, __ATOMIC_ACQUIRE );
+    size_t slot = 0;
+    size_t i;
+    int expected;
+    if ( PoolsNuma_attached_numa == self )
+    {
+        r = 0;
+    }
+    else if ( PoolsNuma_attached_numa == 0 )
+    {
+        /* a Pools left on this node is taken over directly from detached to attached, so frees can always find it */
+        for ( i = 0; i < num_slots && r != 0; ++i )
+        {
+            expected = POOLS_NUMA_THREAD_DETACHED;
+            if ( self->thread_pools[i].numa_node == numa_node
+                 && __atomic_compare_exchange_n( &self->thread_state[i],
+                                                 &expected,
+                                                 POOLS_NUMA_THREAD_ATTACHED,
+                                                 0,
+                                                 __ATOMIC_ACQ_REL,
+                                                 __ATOMIC_RELAXED ) )
+            {
+                Pools_set_owner_thread( &self->thread_pools[i] );
+                slot = i;
+                r = 0;
+            }
+        }
+        for ( i = 0; i < POOLS_NUMA_MAX_THREADS && r != 0; ++i )
+        {
+            expected = POOLS_NUMA_THREAD_UNUSED;
+            if ( __atomic_compare_exchange_n( &self->thread_state[i],
+                                              &expected,
+                                              POOLS_NUMA_THREAD_CLAIMED,
+                                              0,
+                                              __ATOMIC_ACQ_REL,
+                                              __ATOMIC_RELAXED ) )
+            {
+                if ( PoolsNuma_init_thread_pools( self, &self->thread_pools[i], node ) != 0 )
+                {
+                    __atomic_store_n( &self->thread_state[i], POOLS_NUMA_THREAD_UNUSED, __ATOMIC_RELEASE );
+                    break;
+                }
+                num_slots = __atomic_load_n( &self->num_thread_slots, __ATOMIC_RELAXED );
+                while ( num_slots < i + 1
+                        && !__atomic_compare_exchange_n(
+                            &self->num_thread_slots, &num_slots, i + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+                {
+                }
+                __atomic_store_n( &self->thread_state[i], POOLS_NUMA_THREAD_ATTACHED, __ATOMIC_RELEASE );
+                slot = i;
+                r = 0;
+            }
+        }
+        if ( r == 0 )
+        {
+            PoolsNuma_attached_numa = self;
+            PoolsNuma_attached_slot = slot;
+        }
+    }
+    return r;
+}
+
+void PoolsNuma_detach_thread( struct PoolsNuma *self )
+{
+    struct Pools *pools = PoolsNuma_thread_pools( self );
+    if ( pools )
+    {
+        Pools_drain_remote_frees( pools );
+        __atomic_store_n( &pools->owner_thread, (const void *)&PoolsNuma_detached_token, __ATOMIC_RELEASE );
+        __atomic_store_n( &self->thread_state[PoolsNuma_attached_slot], POOLS_NUMA_THREAD_DETACHED, __ATOMIC_RELEASE );
+        PoolsNuma_attached_numa = 0;
+    }
+}
+
+struct Pools *PoolsNuma_thread_pools( struct PoolsNuma *self )
+{
+    return PoolsNuma_attached_numa == self ? &self->thread_pools[PoolsNuma_attached_slot] : 0;
+}
+
+void PoolsNuma_terminate( struct PoolsNuma *self )
+{
+    size_t n;
+    size_t i;
+    for ( n = 0; n < self->num_nodes; ++n )
+    {
+        Pools_terminate( &self->node[n] );
+        pthread_mutex_destroy( &self->node_lock[n] );
+    }
+    for ( i = 0; i < self->num_thread_slots; ++i )
+    {
+        if ( self->thread_state[i] != POOLS_NUMA_THREAD_UNUSED )
+        {
+            Pools_terminate( &self->thread_pools[i] );
+            self->thread_state[i] = POOLS_NUMA_THREAD_UNUSED;
+        }
+    }
+    self->num_thread_slots = 0;
+    self->num_nodes = 0;
+}
+
+void *PoolsNuma_allocate_element( struct PoolsNuma *self, size_t size )
+{
+    void *r;
+    struct Pools *pools = PoolsNuma_thread_pools( self );
+    if ( pools )
+    {
+        r = Pools_allocate_element( pools, size );
+    }
+    else
+    {
+        size_t n = PoolsNuma_current_node( self );
+        pthread_mutex_lock( &self->node_lock[n] );
+        r = Pools_allocate_element( &self->node[n], size );
+        pthread_mutex_unlock( &self->node_lock[n] );
+    }
+    return r;
+}
+
+void PoolsNuma_deallocate_element( struct PoolsNuma *self, void *p )
+{
+    if ( p )
+    {
+        struct Pools *own = PoolsNuma_thread_pools( self );
+        struct Pools *target = 0;
+        size_t num_slots = __atomic_load_n( &self->num_thread_slots, __ATOMIC_ACQUIRE );
+        size_t owner = 0;
+        size_t n;
+        size_t i;
+        int found = 0;
+        /* most items are freed by the thread that allocated them */
+        if ( own && Pools_owns_address( own, p ) )
+        {
+            target = own;
+        }
+        for ( i = 0; i < num_slots && target == 0; ++i )
+        {
+            int state = __atomic_load_n( &self->thread_state[i], __ATOMIC_ACQUIRE );
+            if ( ( state == POOLS_NUMA_THREAD_ATTACHED || state == POOLS_NUMA_THREAD_DETACHED )
+                 && Pools_owns_address( &self->thread_pools[i], p ) )
+            {
+                target = &self->thread_pools[i];
+            }
+        }
+        if ( target )
+        {
+            /* a thread's Pools takes frees from other threads on its remote free list, so no lock is needed */
+            Pools_deallocate_element( target, p );
+        }
+        else
+        {
+            /* the other nodes' pools may be changed under their node_lock meanwhile, so they are only read through the
+             * layout sequence */
+            for ( n = 0; n < self->num_nodes && !found; ++n )
+            {
+                if ( Pools_owns_address( &self->node[n], p ) )
+                {
+                    owner = n;
+                    found = 1;
+                }
+            }
+            /* pointers that are not in any pools were spilled to the heap and are freed through the caller's own Pools or
+             * its node */
+            if ( !found && own )
+            {
+                Pools_deallocate_element( own, p );
+            }
+            else
+            {
+                if ( !found )
+                {
+                    owner = PoolsNuma_current_node( self );
+                }
+                pthread_mutex_lock( &self->node_lock[owner] );
+                Pools_deallocate_element( &self->node[owner], p );
+                pthread_mutex_unlock( &self->node_lock[owner] );
+            }
+        }
+    }
+}
+
+#if defined( stdout ) && !defined( POOL_DISABLE_DIAGNOSTICS )
+void PoolsNuma_diagnostics( struct PoolsNuma *self, const char *prefix, int ( *print )( const char * ) )
+{
+    size_t n;
+    char buf[128];
+    for ( n = 0; n < self->num_nodes; ++n )
+    {
+        char newprefix[128];
+        sprintf( newprefix, "%s:node%zu", prefix, n );
+        pthread_mutex_lock( &self->node_lock[n] );
+        Pools_diagnostics( &self->node[n], newprefix, print );
+        pthread_mutex_unlock( &self->node_lock[n] );
+    }
+    for ( n = 0; n < self->num_thread_slots; ++n )
+    {
+        int state = __atomic_load_n( &self->thread_state[n], __ATOMIC_ACQUIRE );
+        if ( state == POOLS_NUMA_THREAD_ATTACHED || state == POOLS_NUMA_THREAD_DETACHED )
+        {
+            char newprefix[128];
+            sprintf( newprefix, "%s:thread%zu", prefix, n );
+            Pools_diagnostics( &self->thread_pools[n], newprefix, print );
+        }
+    }
+    sprintf( buf, "%s:summary:num_nodes                   :%zu", prefix, self->num_nodes );
+    print( buf );
+    sprintf( buf, "%s:summary:diag_num_bind_failures      :%zu", prefix, self->diag_num_bind_failures );
+    print( buf );
+    print( "" );
+}
+#endif
@@ -0,0 +1,264 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined( _GNU_SOURCE )
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "pools_profile.h"
+
+/* frames belonging to the profiler itself: Pools_profile_record_allocation and Pools_allocate_element or
+ * Pools_allocate_zeroed */
+#define POOLS_PROFILE_SKIP_FRAMES ( 2 )
+
+static size_t Pools_profile_table_size( size_t n )
+{
+    /* keep open addressed tables at most half full so that probes for items that were never sampled stay short */
+    size_t r = 2;
+    while ( r < n * 2 )
+    {
+        r *= 2;
+    }
+    return r;
+}
+
+static size_t Pools_profile_hash_pointer( void const *p )
+{
+    uint64_t h = (uint64_t)(uintptr_t)p * 0x9e3779b97f4a7c15ULL;
+    return (size_t)( h ^ ( h >> 29 ) );
+}
+
+static size_t Pools_profile_next_interval( struct Pools_profile *self )
+{
+    /* uniform jitter in [1, 2 * sample_interval) keeps the mean while avoiding lock step with periodic allocation patterns */
+    uint64_t x = self->random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self->random_state = x;
+    return 1 + (size_t)( x % ( 2 * self->sample_interval - 1 ) );
+}
+
+int Pools_profile_open( struct Pools_profile *self, size_t sample_interval, size_t max_sites, size_t max_live )
+{
+    int r = -1;
+    size_t num_sites = Pools_profile_table_size( max_sites );
+    size_t num_live = Pools_profile_table_size( max_live );
+    memset( self, 0, sizeof( *self ) );
+    if ( sample_interval > 0 && max_sites > 0 && max_live > 0 )
+    {
+        void *frames[1];
+        void *m;
+        /* the first backtrace call may load the unwinder, which allocates; do that now rather than while sampling */
+        backtrace( frames, 1 );
+        self->mapping_size = num_sites * sizeof( struct Pools_profile_site ) + num_live * sizeof( struct Pools_profile_live );
+        m = mmap( 0, self->mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( m != MAP_FAILED )
+        {
+            self->sites = (struct Pools_profile_site *)m;
+            self->site_mask = num_sites - 1;
+            self->live = (struct Pools_profile_live *)( self->sites + num_sites );
+            self->live_mask = num_live - 1;
+            self->sample_interval = sample_interval;
+            self->random_state = 0x2545f4914f6cdd1dULL ^ (uint64_t)(uintptr_t)self;
+            self->bytes_until_sample = (ptrdiff_t)Pools_profile_next_interval( self );
+            r = 0;
+        }
+    }
+    return r;
+}
+
+void Pools_profile_close( struct Pools_profile *self )
+{
+    if ( self->sites )
+    {
+        munmap( self->sites, self->mapping_size );
+    }
+    memset( self, 0, sizeof( *self ) );
+}
+
+static struct Pools_profile_site *
+    Pools_profile_find_site( struct Pools_profile *self, void *const *frames, size_t depth, size_t class_size )
+{
+    size_t h = class_size;
+    size_t i;
+    for ( i = 0; i < depth; ++i )
+    {
+        h = ( h ^ Pools_profile_hash_pointer( frames[i] ) ) * 0x100000001b3ULL;
+    }
+    for ( i = h & self->site_mask;; i = ( i + 1 ) & self->site_mask )
+    {
+        struct Pools_profile_site *site = &self->sites[i];
+        if ( site->depth == 0 )
+        {
+            if ( ( self->num_sites + 1 ) * 2 > self->site_mask + 1 )
+            {
+                return 0;
+            }
+            ++self->num_sites;
+            memcpy( site->frames, frames, depth * sizeof( void * ) );
+            site->depth = depth;
+            site->class_size = class_size;
+            return site;
+        }
+        if ( site->depth == depth && site->class_size == class_size
+             && memcmp( site->frames, frames, depth * sizeof( void * ) ) == 0 )
+        {
+            return site;
+        }
+    }
+}
+
+void Pools_profile_record_allocation( struct Pools_profile *self, size_t class_size, void const *p )
+{
+    void *frames[POOLS_PROFILE_MAX_FRAMES + POOLS_PROFILE_SKIP_FRAMES];
+    int depth = backtrace( frames, POOLS_PROFILE_MAX_FRAMES + POOLS_PROFILE_SKIP_FRAMES );
+    struct Pools_profile_site *site;
+    size_t bytes = 0;
+
+    /* each time the countdown is restarted the sample stands for one more mean interval of allocated bytes */
+    while ( self->bytes_until_sample <= 0 )
+    {
+        self->bytes_until_sample += (ptrdiff_t)Pools_profile_next_interval( self );
+        bytes += self->sample_interval;
+    }
+    ++self->diag_num_samples;
+
+    site = depth > POOLS_PROFILE_SKIP_FRAMES ? Pools_profile_find_site( self,
+                                                                           frames + POOLS_PROFILE_SKIP_FRAMES,
+                                                                           (size_t)depth - POOLS_PROFILE_SKIP_FRAMES,
+                                                                           class_size )
+                                             : 0;
+    if ( site == 0 || ( self->num_live + 1 ) * 2 > self->live_mask + 1 )
+    {
+        ++self->diag_num_dropped_samples;
+    }
+    else
+    {
+        size_t i = Pools_profile_hash_pointer( p ) & self->live_mask;
+        while ( self->live[i].p )
+        {
+            i = ( i + 1 ) & self->live_mask;
+        }
+        self->live[i].p = p;
+        self->live[i].site = (size_t)( site - self->sites );
+        self->live[i].bytes = bytes;
+        ++self->num_live;
+        ++site->total_samples;
+        site->total_bytes += bytes;
+        ++site->live_samples;
+        site->live_bytes += bytes;
+    }
+}
+
+void Pools_profile_record_deallocation( struct Pools_profile *self, void const *p )
+{
+    size_t i = Pools_profile_hash_pointer( p ) & self->live_mask;
+    while ( self->live[i].p && self->live[i].p != p )
+    {
+        i = ( i + 1 ) & self->live_mask;
+    }
+    if ( self->live[i].p )
+    {
+        struct Pools_profile_site *site = &self->sites[self->live[i].site];
+        size_t hole = i;
+        --site->live_samples;
+        site->live_bytes -= self->live[i].bytes;
+        --self->num_live;
+
+        /* backward shift deletion keeps every remaining entry reachable from its home slot without tombstones */
+        for ( i = ( hole + 1 ) & self->live_mask; self->live[i].p; i = ( i + 1 ) & self->live_mask )
+        {
+            size_t home = Pools_profile_hash_pointer( self->live[i].p ) & self->live_mask;
+            if ( ( ( i - home ) & self->live_mask ) >= ( ( i - hole ) & self->live_mask ) )
+            {
+                self->live[hole] = self->live[i];
+                hole = i;
+            }
+        }
+        self->live[hole].p = 0;
+    }
+}
+
+static size_t Pools_profile_append_frame( char *buf, size_t pos, size_t buf_size, void *frame )
+{
+    Dl_info info;
+    const char *module;
+    int n;
+    int found = dladdr( frame, &info );
+    if ( found && info.dli_sname )
+    {
+        n = snprintf( buf + pos, buf_size - pos, ";%s", info.dli_sname );
+    }
+    else if ( found && info.dli_fname )
+    {
+        module = strrchr( info.dli_fname, '/' );
+        module = module ? module + 1 : info.dli_fname;
+        n = snprintf( buf + pos, buf_size - pos, ";%s+0x%zx", module, (size_t)( (char *)frame - (char *)info.dli_fbase ) );
+    }
+    else
+    {
+        n = snprintf( buf + pos, buf_size - pos, ";%p", frame );
+    }
+    return n > 0 && pos + (size_t)n < buf_size ? pos + (size_t)n : pos;
+}
+
+void Pools_profile_report( struct Pools_profile *self, int live, int ( *print )( const char * ) )
+{
+    char buf[4096];
+    size_t i;
+    for ( i = 0; self->sites && i <= self->site_mask; ++i )
+    {
+        struct Pools_profile_site *site = &self->sites[i];
+        size_t bytes = live ? site->live_bytes : site->total_bytes;
+        size_t pos;
+        size_t f;
+        if ( site->depth == 0 || bytes == 0 )
+        {
+            continue;
+        }
+        if ( site->class_size )
+        {
+            pos = (size_t)snprintf( buf, sizeof( buf ), "pool_%zu", site->class_size );
+        }
+        else
+        {
+            pos = (size_t)snprintf( buf, sizeof( buf ), "heap" );
+        }
+        /* leave room for the value */
+        for ( f = site->depth; f > 0; --f )
+        {
+            pos = Pools_profile_append_frame( buf, pos, sizeof( buf ) - 32, site->frames[f - 1] );
+        }
+        snprintf( buf + pos, sizeof( buf ) - pos, " %zu", bytes );
+        print( buf );
+    }
+}
@@ -0,0 +1,100 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "pools_trace.h"
+
+static uint16_t pools_trace_next_thread = 0;
+static __thread uint16_t pools_trace_thread = 0;
+
+static uint64_t Pools_trace_now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int Pools_trace_open( struct Pools_trace *self, const char *path, size_t capacity )
+{
+    int r = -1;
+    int fd;
+    memset( self, 0, sizeof( *self ) );
+    self->mapping_size = sizeof( struct Pools_trace_header ) + capacity * sizeof( struct Pools_trace_record );
+    fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd >= 0 && capacity > 0 )
+    {
+        if ( ftruncate( fd, (off_t)self->mapping_size ) == 0 )
+        {
+            void *m = mmap( 0, self->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+            if ( m != MAP_FAILED )
+            {
+                self->header = (struct Pools_trace_header *)m;
+                self->records = (struct Pools_trace_record *)( self->header + 1 );
+                self->header->capacity = capacity;
+                self->header->head = 0;
+                self->header->start_ns = Pools_trace_now_ns();
+                __atomic_store_n( &self->header->magic, POOLS_TRACE_MAGIC, __ATOMIC_RELEASE );
+                r = 0;
+            }
+        }
+    }
+    if ( fd >= 0 )
+    {
+        /* the mapping keeps the file alive */
+        close( fd );
+    }
+    return r;
+}
+
+void Pools_trace_close( struct Pools_trace *self )
+{
+    if ( self->header )
+    {
+        munmap( self->header, self->mapping_size );
+    }
+    memset( self, 0, sizeof( *self ) );
+}
+
+void Pools_trace_record( struct Pools_trace *self, int op, size_t size, void const *p )
+{
+    uint64_t n = __atomic_fetch_add( &self->header->head, 1, __ATOMIC_RELAXED );
+    struct Pools_trace_record *record = &self->records[n % self->header->capacity];
+    if ( pools_trace_thread == 0 )
+    {
+        pools_trace_thread = __atomic_add_fetch( &pools_trace_next_thread, 1, __ATOMIC_RELAXED );
+    }
+    record->timestamp_ns = Pools_trace_now_ns() - self->header->start_ns;
+    record->object_id = (uint64_t)(uintptr_t)p;
+    record->size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    record->thread = pools_trace_thread;
+    record->op = (uint8_t)op;
+    record->reserved = 0;
+}
@@ -84,6 +84,109 @@ int main()
     }
     Pools_diagnostics( &my_pools, "", my_print );
 
+    {
+        my_allocator<char> chars( &my_pools );
+        auto r = chars.allocate_at_least( 65 );
+        if ( r.ptr == 0 || r.count != 256 )
+        {
+            std::cout << "allocate_at_least did not report the whole element" << std::endl;
+            return 1;
+        }
+        chars.deallocate( r.ptr, r.count );
+    }
+
+    {
+        /* containers on the same Pools move and swap by stealing the storage; across Pools the elements are moved into
+         * the target's own Pools on move and copy assignment, and the allocators travel with the storage on swap */
+        typedef std::vector<int, my_allocator<int> > int_vector;
+        Pools other_pools;
+        Pools_init( &other_pools, "other_pools", my_allocation, my_free );
+        Pools_add( &other_pools, 256, 16 );
+        my_allocator<int> ints( &my_pools );
+        my_allocator<int> other_ints( &other_pools );
+        static_assert( !std::allocator_traits<my_allocator<int> >::is_always_equal::value, "is_always_equal" );
+        if ( !( ints == my_allocator<char>( &my_pools ) ) || ints == other_ints || !( ints != other_ints ) )
+        {
+            std::cout << "pools_allocator equality" << std::endl;
+            return 1;
+        }
+
+        int_vector a( 40, 7, ints );
+        int_vector b( ints );
+        int_vector c( other_ints );
+        const int *storage = a.data();
+        b = std::move( a );
+        if ( b.data() != storage )
+        {
+            std::cout << "same pools move assignment copied the elements" << std::endl;
+            return 1;
+        }
+        c = std::move( b );
+        if ( c.get_allocator() != other_ints || c.size() != 40 || c[39] != 7
+             || !Pools_find_pool_for_address( &other_pools, c.data() ) )
+        {
+            std::cout << "cross pools move assignment" << std::endl;
+            return 1;
+        }
+        a.assign( 10, 3 );
+        c = a;
+        if ( c.get_allocator() != other_ints || c.size() != 10 || !Pools_find_pool_for_address( &other_pools, c.data() ) )
+        {
+            std::cout << "cross pools copy assignment" << std::endl;
+            return 1;
+        }
+        storage = c.data();
+        a.swap( c );
+        if ( a.data() != storage || a.get_allocator() != other_ints || c.get_allocator() != ints )
+        {
+            std::cout << "cross pools swap" << std::endl;
+            return 1;
+        }
+        b.assign( 5, 1 );
+        storage = b.data();
+        b.swap( c );
+        if ( c.data() != storage || b.size() != 10 )
+        {
+            std::cout << "same pools swap" << std::endl;
+            return 1;
+        }
+        a.clear();
+        a.shrink_to_fit();
+        if ( other_pools.pool[0].total_allocated_items != 0 )
+        {
+            std::cout << "other pools leaked" << std::endl;
+            return 1;
+        }
+        Pools_terminate( &other_pools );
+    }
+
+#if defined( __cpp_lib_memory_resource )
+    {
+        PoolsAllocator::pools_memory_resource resource( &my_pools );
+        std::pmr::vector<std::pmr::string> v( &resource );
+        v.emplace_back( "a string that is too long for the small string buffer" );
+        v.emplace_back( "another string that is too long for the small string buffer" );
+        if ( !Pools_find_pool_for_address( &my_pools, v.data() ) || !Pools_find_pool_for_address( &my_pools, v[1].data() ) )
+        {
+            std::cout << "pools_memory_resource did not allocate from the pools" << std::endl;
+            return 1;
+        }
+        void *aligned = resource.allocate( 64, 128 );
+        if ( Pools_find_pool_for_address( &my_pools, aligned ) || ( reinterpret_cast<uintptr_t>( aligned ) & 127 ) != 0 )
+        {
+            std::cout << "pools_memory_resource over aligned allocation" << std::endl;
+            return 1;
+        }
+        resource.deallocate( aligned, 64, 128 );
+        PoolsAllocator::pools_memory_resource same( &my_pools );
+        if ( !resource.is_equal( same ) || resource.is_equal( *std::pmr::new_delete_resource() ) )
+        {
+            std::cout << "pools_memory_resource equality" << std::endl;
+            return 1;
+        }
+    }
+#endif
+
     Pools_terminate( &my_pools );
 }
 #else
@@ -0,0 +1,139 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <iostream>
+#include "PoolsAllocator.hpp"
+
+#if defined( __cpp_impl_coroutine ) && __has_include( <coroutine> )
+#include <coroutine>
+
+void *my_allocation( size_t sz ) { return malloc( sz ); }
+
+void my_free( void *p ) { free( p ); }
+
+int my_print( const char *s )
+{
+    std::cout << s << std::endl;
+    return 0;
+}
+
+struct task
+{
+    struct promise_type : PoolsAllocator::pools_promise_base
+    {
+        int value = 0;
+        task get_return_object() { return task{std::coroutine_handle<promise_type>::from_promise( *this )}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value( int v ) { value = v; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit task( std::coroutine_handle<promise_type> h ) : m_handle( h ) {}
+    task( task &&other ) noexcept : m_handle( other.m_handle ) { other.m_handle = nullptr; }
+    task( const task & ) = delete;
+    ~task()
+    {
+        if ( m_handle )
+        {
+            m_handle.destroy();
+        }
+    }
+
+    int run()
+    {
+        m_handle.resume();
+        return m_handle.promise().value;
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+task add_using_thread_pools( int a, int b ) { co_return a + b; }
+
+task add_using_explicit_pools( std::allocator_arg_t, Pools *, int a, int b ) { co_return a + b; }
+
+size_t total_allocated_items( Pools *pools )
+{
+    size_t total = 0;
+    for ( size_t i = 0; i < pools->num_pools; ++i )
+    {
+        total += pools->pool[i].total_allocated_items;
+    }
+    return total;
+}
+
+int main()
+{
+    Pools thread_pools;
+    Pools explicit_pools;
+    Pools_init( &thread_pools, "thread_pools", my_allocation, my_free );
+    Pools_add( &thread_pools, 256, 64 );
+    Pools_init( &explicit_pools, "explicit_pools", my_allocation, my_free );
+    Pools_add( &explicit_pools, 256, 64 );
+
+    {
+        PoolsAllocator::pools_coroutine_scope scope( &thread_pools );
+        task t1 = add_using_thread_pools( 1, 2 );
+        task t2 = add_using_explicit_pools( std::allocator_arg, &explicit_pools, 3, 4 );
+        if ( total_allocated_items( &thread_pools ) != 1 || total_allocated_items( &explicit_pools ) != 1 )
+        {
+            std::cout << "coroutine frames were not allocated from the expected Pools" << std::endl;
+            return 1;
+        }
+        if ( t1.run() != 3 || t2.run() != 7 )
+        {
+            std::cout << "coroutines returned the wrong value" << std::endl;
+            return 1;
+        }
+    }
+    {
+        task t3 = add_using_thread_pools( 5, 6 );
+        if ( t3.run() != 11 || total_allocated_items( &thread_pools ) != 0 )
+        {
+            std::cout << "coroutine outside of a scope should use the heap" << std::endl;
+            return 1;
+        }
+    }
+    if ( total_allocated_items( &thread_pools ) != 0 || total_allocated_items( &explicit_pools ) != 0 )
+    {
+        std::cout << "coroutine frames were not returned to their Pools" << std::endl;
+        return 1;
+    }
+
+    PoolsAllocator::pools_coroutine_frame_stats::diagnostics( "frames", my_print );
+    Pools_diagnostics( &thread_pools, "", my_print );
+    Pools_terminate( &thread_pools );
+    Pools_terminate( &explicit_pools );
+    return 0;
+}
+#else
+int main()
+{
+    std::cout << "test requires c++20 coroutines" << std::endl;
+    return 0;
+}
+#endif
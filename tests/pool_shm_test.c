@@ -0,0 +1,193 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "pool_shm.h"
+
+#define SHM_ELEMENTS ( 200000 )
+#define SHM_ELEMENT_SIZE ( 48 )
+#define SHM_MESSAGE "hello from the parent"
+
+/* each process claims elements and stamps them with its id; a duplicate claim shows up as a mismatched stamp */
+static size_t claim_all( struct PoolShm *shm, char id )
+{
+    size_t claimed = 0;
+    void *p;
+    while ( ( p = PoolShm_allocate_element( shm ) ) != 0 )
+    {
+        memset( p, id, SHM_ELEMENT_SIZE );
+        ++claimed;
+    }
+    return claimed;
+}
+
+static int child( const char *name, size_t message_element, int ready_fd )
+{
+    struct PoolShm shm;
+    char *message;
+    if ( PoolShm_open( &shm, name ) )
+    {
+        return 1;
+    }
+    message = (char *)PoolShm_get_address_for_element( &shm, message_element );
+    if ( !message || strcmp( message, SHM_MESSAGE ) != 0 )
+    {
+        return 2;
+    }
+    if ( PoolShm_deallocate_element( &shm, message ) != (ssize_t)message_element )
+    {
+        return 3;
+    }
+    /* let the parent start claiming so that both processes race for the remaining elements */
+    if ( write( ready_fd, "r", 1 ) != 1 )
+    {
+        return 4;
+    }
+    claim_all( &shm, 'c' );
+    PoolShm_close( &shm );
+    return 0;
+}
+
+int main()
+{
+    struct PoolShm shm;
+    char name[64];
+    ssize_t message_element;
+    char *message;
+    pid_t pid;
+    int status = 0;
+    int ready[2];
+    char ready_byte;
+    size_t parent_claimed;
+    size_t child_claimed = 0;
+    size_t i;
+
+    sprintf( name, "/pools_shm_test_%d", (int)getpid() );
+    if ( PoolShm_create( &shm, name, SHM_ELEMENTS, SHM_ELEMENT_SIZE ) )
+    {
+        POOL_ABORT( "create" );
+    }
+
+    /* a segment that is in use is never replaced by a second create */
+    {
+        struct PoolShm other;
+        if ( PoolShm_create( &other, name, SHM_ELEMENTS, SHM_ELEMENT_SIZE ) == 0 || errno != EEXIST )
+        {
+            POOL_ABORT( "create replaced an existing segment" );
+        }
+    }
+
+    message_element = PoolShm_allocate_index( &shm );
+    message = (char *)PoolShm_get_address_for_element( &shm, (size_t)message_element );
+    strcpy( message, SHM_MESSAGE );
+
+    if ( pipe( ready ) )
+    {
+        POOL_ABORT( "pipe" );
+    }
+    pid = fork();
+    if ( pid == 0 )
+    {
+        _exit( child( name, (size_t)message_element, ready[1] ) );
+    }
+    if ( pid < 0 || read( ready[0], &ready_byte, 1 ) != 1 )
+    {
+        POOL_ABORT( "fork" );
+    }
+    parent_claimed = claim_all( &shm, 'p' );
+    if ( waitpid( pid, &status, 0 ) != pid || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+    {
+        fprintf( stderr, "child failed with status %d\n", status );
+        POOL_ABORT( "child" );
+    }
+
+    /* the message element was released by the child, so it may have been reclaimed by either process */
+    for ( i = 0; i < SHM_ELEMENTS; ++i )
+    {
+        char *p = (char *)PoolShm_get_address_for_element( &shm, i );
+        size_t j;
+        if ( Pool_is_element_available( &shm.view, i ) )
+        {
+            continue;
+        }
+        for ( j = 1; j < SHM_ELEMENT_SIZE; ++j )
+        {
+            if ( p[j] != p[0] )
+            {
+                POOL_ABORT( "element claimed by both processes" );
+            }
+        }
+        if ( p[0] == 'c' )
+        {
+            ++child_claimed;
+        }
+    }
+    fprintf( stdout, "parent claimed %zu, child claimed %zu\n", parent_claimed, child_claimed );
+    if ( parent_claimed + child_claimed != SHM_ELEMENTS || shm.header->total_allocated_items != SHM_ELEMENTS )
+    {
+        POOL_ABORT( "claim count" );
+    }
+
+    for ( i = 0; i < SHM_ELEMENTS; ++i )
+    {
+        PoolShm_deallocate_index( &shm, i );
+    }
+    if ( shm.header->total_allocated_items != 0 || PoolShm_allocate_index( &shm ) < 0 )
+    {
+        POOL_ABORT( "release" );
+    }
+
+    /* a header whose layout does not fit the segment is rejected */
+    {
+        struct PoolShm other;
+        uint64_t element_size = shm.header->element_size;
+        shm.header->element_size = element_size * 2;
+        if ( PoolShm_open( &other, name ) == 0 )
+        {
+            POOL_ABORT( "opened a segment with a corrupt layout" );
+        }
+        shm.header->element_size = element_size;
+        shm.header->allocated_flags_offset = shm.header->element_storage_offset;
+        if ( PoolShm_open( &other, name ) == 0 )
+        {
+            POOL_ABORT( "opened a segment with overlapping flags and storage" );
+        }
+        shm.header->allocated_flags_offset = sizeof( struct PoolShm_header );
+        if ( PoolShm_open( &other, name ) != 0 )
+        {
+            POOL_ABORT( "reopen" );
+        }
+        PoolShm_close( &other );
+    }
+
+    PoolShm_diagnostics( &shm, "pool_shm_test:", puts );
+    PoolShm_close( &shm );
+    PoolShm_unlink( name );
+    return 0;
+}
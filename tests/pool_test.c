@@ -38,12 +38,14 @@ void my_low_level_free( void *p ) { free( p ); }
 void exercise_pool()
 {
     void *ptrs[EXERCISE_POOL_COUNT];
+    size_t sizes[EXERCISE_POOL_COUNT];
     size_t max_ptrs = EXERCISE_POOL_COUNT;
     size_t i;
 
     for ( i = 0; i < max_ptrs; ++i )
     {
         size_t sz = random() % 7000;
+        sizes[i] = sz;
         ptrs[i] = Pools_allocate_element( &my_pools, sz );
     }
 
@@ -53,6 +55,11 @@ void exercise_pool()
 
     for ( i = 0; i < max_ptrs; ++i )
     {
+        size_t usable = Pools_usable_size( &my_pools, ptrs[i] );
+        if ( usable != 0 && ( usable < sizes[i] || Pools_find_pool_for_address( &my_pools, ptrs[i] ) == 0 ) )
+        {
+            POOL_ABORT( "usable_size" );
+        }
         Pools_deallocate_element( &my_pools, ptrs[i] );
     }
 
@@ -61,6 +68,542 @@ void exercise_pool()
 #endif
 }
 
+#define PLACEMENT_COUNT ( 200 )
+size_t allocate_index( struct Pool *pool )
+{
+    void *p = Pool_allocate_element( pool );
+    if ( p == 0 )
+    {
+        POOL_ABORT( "placement allocate" );
+    }
+    return (size_t)Pool_get_element_for_address( pool, p );
+}
+
+void exercise_placement( enum Pool_placement_policy policy, const size_t *expected )
+{
+    struct Pool pool;
+    size_t i;
+    if ( Pool_init( &pool, PLACEMENT_COUNT, 32, my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "placement init" );
+    }
+    Pool_set_placement_policy( &pool, policy );
+    for ( i = 0; i < PLACEMENT_COUNT / 2; ++i )
+    {
+        allocate_index( &pool );
+    }
+    Pool_deallocate_element( &pool, Pool_get_address_for_element( &pool, 10 ) );
+    Pool_deallocate_element( &pool, Pool_get_address_for_element( &pool, 50 ) );
+    for ( i = 0; i < 3; ++i )
+    {
+        if ( allocate_index( &pool ) != expected[i] )
+        {
+            POOL_ABORT( "placement policy picked the wrong element" );
+        }
+    }
+    while ( pool.total_allocated_items < PLACEMENT_COUNT )
+    {
+        allocate_index( &pool );
+    }
+    if ( Pool_allocate_element( &pool ) != 0 )
+    {
+        POOL_ABORT( "placement allocated past the end of the pool" );
+    }
+    Pool_terminate( &pool );
+}
+
+void exercise_lifo_out_of_order()
+{
+    struct Pool pool;
+    size_t i;
+    if ( Pool_init( &pool, PLACEMENT_COUNT, 32, my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "lifo init" );
+    }
+    for ( i = 0; i < PLACEMENT_COUNT / 2; ++i )
+    {
+        allocate_index( &pool );
+    }
+    Pool_deallocate_element( &pool, Pool_get_address_for_element( &pool, 10 ) );
+    Pool_deallocate_element( &pool, Pool_get_address_for_element( &pool, 20 ) );
+    Pool_deallocate_element( &pool, Pool_get_address_for_element( &pool, 30 ) );
+    /* take 20 from the middle of the free stack and scribble over its link */
+    Pool_mark_element_allocated( &pool, 20 );
+    memset( Pool_get_address_for_element( &pool, 20 ), 0xff, 32 );
+    if ( allocate_index( &pool ) != 30 )
+    {
+        POOL_ABORT( "lifo did not reuse the most recently freed element" );
+    }
+    if ( allocate_index( &pool ) != PLACEMENT_COUNT / 2 )
+    {
+        POOL_ABORT( "lifo did not fall back to scanning past a broken free stack" );
+    }
+    Pool_terminate( &pool );
+}
+
+void exercise_placement_policies()
+{
+    static const size_t lifo[3] = {50, 10, 100};
+    static const size_t lowest_address[3] = {10, 50, 100};
+    static const size_t round_robin[3] = {100, 101, 102};
+    exercise_placement( POOL_PLACEMENT_LIFO, lifo );
+    exercise_placement( POOL_PLACEMENT_LOWEST_ADDRESS, lowest_address );
+    exercise_placement( POOL_PLACEMENT_ROUND_ROBIN, round_robin );
+    exercise_lifo_out_of_order();
+}
+
+void exercise_address_mapping()
+{
+    static const size_t element_sizes[] = {1, 8, 24, 64, 100, 4096, 12345};
+    size_t n;
+    for ( n = 0; n < sizeof( element_sizes ) / sizeof( element_sizes[0] ); ++n )
+    {
+        struct Pool pool;
+        size_t i;
+        unsigned char *base;
+        if ( Pool_init( &pool, 300, element_sizes[n], my_low_level_allocation, my_low_level_free ) )
+        {
+            POOL_ABORT( "mapping init" );
+        }
+        base = pool.element_storage;
+        for ( i = 0; i < pool.element_storage_size; ++i )
+        {
+            ssize_t expected = ( i % pool.element_size ) == 0 ? (ssize_t)( i / pool.element_size ) : -1;
+            if ( Pool_get_element_for_address( &pool, base + i ) != expected
+                 || Pool_is_address_in_pool( &pool, base + i ) != ( expected >= 0 ) )
+            {
+                POOL_ABORT( "address mapping" );
+            }
+        }
+        if ( Pool_is_address_in_pool( &pool, base - 1 ) || Pool_is_address_in_pool( &pool, base + pool.element_storage_size )
+             || Pool_get_element_for_address( &pool, base - pool.element_size ) != -1 )
+        {
+            POOL_ABORT( "address mapping out of range" );
+        }
+        Pool_terminate( &pool );
+    }
+    /* offsets past 2^31 and 2^32, where a 32 bit truncation would show, on views over a fake base that is never touched */
+    for ( n = 0; n < sizeof( element_sizes ) / sizeof( element_sizes[0] ); ++n )
+    {
+        struct Pool pool;
+        size_t size = element_sizes[n];
+        size_t num_elements = ( (size_t)5 << 30 ) / size + 1;
+        unsigned char *base = (unsigned char *)( (uintptr_t)1 << 44 );
+        size_t probes[7];
+        size_t i;
+        probes[0] = ( (size_t)1 << 31 ) / size - 1;
+        probes[1] = ( (size_t)1 << 31 ) / size;
+        probes[2] = ( (size_t)1 << 31 ) / size + 1;
+        probes[3] = ( (size_t)1 << 32 ) / size;
+        probes[4] = ( (size_t)1 << 32 ) / size + 1;
+        probes[5] = num_elements - 2;
+        probes[6] = num_elements - 1;
+        Pool_init_view( &pool, num_elements, size, 0, base );
+        for ( i = 0; i < sizeof( probes ) / sizeof( probes[0] ); ++i )
+        {
+            unsigned char *element = base + probes[i] * size;
+            if ( Pool_get_element_for_address( &pool, element ) != (ssize_t)probes[i]
+                 || ( size > 1
+                      && ( Pool_get_element_for_address( &pool, element + 1 ) != -1
+                           || Pool_get_element_for_address( &pool, element + size / 2 ) != -1
+                           || Pool_get_element_for_address( &pool, element + size - 1 ) != -1 ) ) )
+            {
+                POOL_ABORT( "address mapping above 2GiB" );
+            }
+        }
+        if ( Pool_get_element_for_address( &pool, base + pool.element_storage_size ) != -1
+             || Pool_get_element_for_address( &pool, base + pool.element_storage_size + size ) != -1
+             || Pool_get_element_for_address( &pool, base - size ) != -1 )
+        {
+            POOL_ABORT( "address mapping past the end of a large pool" );
+        }
+        Pool_terminate( &pool );
+    }
+    {
+        struct Pool pool;
+        if ( Pool_init( &pool, ( (size_t)1 << 62 ), 8, my_low_level_allocation, my_low_level_free ) == 0 )
+        {
+            POOL_ABORT( "storage size overflow was not detected" );
+        }
+    }
+}
+
+struct Walk
+{
+    struct Pool *pool;
+    void *previous;
+    size_t visited;
+    size_t stop_after;
+};
+
+int check_walk( void *context, struct Pool *pool, void *element )
+{
+    struct Walk *walk = (struct Walk *)context;
+    if ( pool != walk->pool )
+    {
+        walk->pool = pool;
+        walk->previous = 0;
+    }
+    if ( element <= walk->previous || Pool_is_element_available( pool, (size_t)Pool_get_element_for_address( pool, element ) ) )
+    {
+        POOL_ABORT( "walk out of order or visited an available element" );
+    }
+    walk->previous = element;
+    return ++walk->visited == walk->stop_after;
+}
+
+int sweep_stale( void *context, struct Pool *pool, void *element )
+{
+    (void)context;
+    if ( *(unsigned char *)element == 's' )
+    {
+        Pool_deallocate_element( pool, element );
+    }
+    return 0;
+}
+
+int sweep_pools( void *context, struct Pool *pool, void *element )
+{
+    (void)pool;
+    Pools_deallocate_element( (struct Pools *)context, element );
+    return 0;
+}
+
+void exercise_for_each_allocated()
+{
+    struct Pool pool;
+    struct Walk walk;
+    size_t i;
+    /* an element count that is not a multiple of the flag word size so that the padding bits are exercised */
+    if ( Pool_init( &pool, 1000, 32, my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "for_each init" );
+    }
+    for ( i = 0; i < 1000; ++i )
+    {
+        unsigned char *p = (unsigned char *)Pool_allocate_element( &pool );
+        *p = ( i % 5 ) == 0 ? 's' : 'l';
+    }
+    for ( i = 0; i < 1000; i += 3 )
+    {
+        Pool_deallocate_element( &pool, Pool_get_address_for_element( &pool, i ) );
+    }
+    memset( &walk, 0, sizeof( walk ) );
+    if ( Pool_for_each_allocated( &pool, check_walk, &walk ) != 666 || walk.visited != 666
+         || Pool_count_allocated( &pool ) != 666 || pool.total_allocated_items != 666 )
+    {
+        POOL_ABORT( "for_each count" );
+    }
+    memset( &walk, 0, sizeof( walk ) );
+    walk.stop_after = 10;
+    if ( Pool_for_each_allocated( &pool, check_walk, &walk ) != 10 )
+    {
+        POOL_ABORT( "for_each stop" );
+    }
+
+    /* sweep the stale elements that are still allocated: i % 5 == 0 and i % 3 != 0 */
+    Pool_for_each_allocated( &pool, sweep_stale, 0 );
+    if ( Pool_count_allocated( &pool ) != 533 || pool.total_allocated_items != 533 )
+    {
+        POOL_ABORT( "sweep" );
+    }
+    Pool_terminate( &pool );
+
+    for ( i = 0; i < 16; ++i )
+    {
+        if ( Pools_allocate_element( &my_pools, 10 + i * 300 ) == 0 )
+        {
+            POOL_ABORT( "Pools for_each alloc" );
+        }
+    }
+    memset( &walk, 0, sizeof( walk ) );
+    if ( Pools_for_each_allocated( &my_pools, check_walk, &walk ) != 16 || walk.visited != 16 )
+    {
+        POOL_ABORT( "Pools for_each count" );
+    }
+    memset( &walk, 0, sizeof( walk ) );
+    walk.stop_after = 1;
+    if ( Pools_for_each_allocated( &my_pools, check_walk, &walk ) != 1 )
+    {
+        POOL_ABORT( "Pools for_each stop" );
+    }
+    Pools_for_each_allocated( &my_pools, sweep_pools, &my_pools );
+    for ( i = 0; i < my_pools.num_pools; ++i )
+    {
+        if ( my_pools.pool[i].total_allocated_items != 0 )
+        {
+            POOL_ABORT( "Pools sweep" );
+        }
+    }
+}
+
+static int is_zero( const unsigned char *p, size_t len )
+{
+    size_t i;
+    for ( i = 0; i < len; ++i )
+    {
+        if ( p[i] )
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void exercise_zeroed()
+{
+    struct Pools zpools;
+    unsigned char *items[64];
+    unsigned char *big;
+    size_t i;
+    if ( Pools_init( &zpools, "zeroed", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "zeroed init" );
+    }
+    Pools_set_low_level_zeroed_allocation_function( &zpools, calloc );
+    if ( Pools_add( &zpools, 128, 64 ) )
+    {
+        POOL_ABORT( "zeroed add" );
+    }
+
+    /* fresh elements are handed out without clearing */
+    for ( i = 0; i < 64; ++i )
+    {
+        items[i] = (unsigned char *)Pools_allocate_zeroed( &zpools, 100 );
+        if ( !is_zero( items[i], 128 ) )
+        {
+            POOL_ABORT( "fresh zeroed element is not zero" );
+        }
+        memset( items[i], 0xa5, 128 );
+    }
+    if ( zpools.pool[0].diag_num_clears_skipped != 64 || zpools.pool[0].diag_num_clears != 0 )
+    {
+        POOL_ABORT( "fresh elements were cleared" );
+    }
+
+    /* recycled elements are cleared, whichever way they were allocated before */
+    for ( i = 0; i < 64; i += 2 )
+    {
+        Pools_deallocate_element( &zpools, items[i] );
+    }
+    for ( i = 0; i < 64; i += 2 )
+    {
+        items[i] = (unsigned char *)Pools_allocate_zeroed( &zpools, 100 );
+        if ( !is_zero( items[i], 128 ) )
+        {
+            POOL_ABORT( "recycled zeroed element is not zero" );
+        }
+    }
+    if ( zpools.pool[0].diag_num_clears != 32 )
+    {
+        POOL_ABORT( "recycled elements were not cleared" );
+    }
+
+    /* spills to the heap are zeroed too */
+    big = (unsigned char *)Pools_allocate_zeroed( &zpools, 1000 );
+    if ( !big || !is_zero( big, 1000 ) )
+    {
+        POOL_ABORT( "zeroed heap spill" );
+    }
+    Pools_deallocate_element( &zpools, big );
+    for ( i = 0; i < 64; ++i )
+    {
+        Pools_deallocate_element( &zpools, items[i] );
+    }
+    Pools_terminate( &zpools );
+}
+
+static void *filled_allocation( size_t sz )
+{
+    void *p = malloc( sz );
+    if ( p )
+    {
+        memset( p, 0x5a, sz );
+    }
+    return p;
+}
+
+static void check_storage_unwritten( void *context, struct Pool *pool )
+{
+    size_t i;
+    for ( i = 0; i < pool->element_storage_size; ++i )
+    {
+        if ( pool->element_storage[i] != 0x5a )
+        {
+            POOL_ABORT( "storage written before it was placed" );
+        }
+    }
+    ++*(size_t *)context;
+}
+
+/* the storage is placed before Pool_init_placed clears it, and cleared afterwards */
+void exercise_placed()
+{
+    struct Pool pool;
+    size_t calls = 0;
+    if ( Pool_init_placed( &pool, 64, 32, filled_allocation, 0, my_low_level_free, check_storage_unwritten, &calls )
+         || calls != 1 || !is_zero( pool.element_storage, pool.element_storage_size ) )
+    {
+        POOL_ABORT( "placed init" );
+    }
+    Pool_terminate( &pool );
+}
+
+void exercise_handles()
+{
+    struct Pools hpools;
+    struct Pool grown;
+    uint32_t handles[16];
+    uint32_t stale;
+    size_t i;
+    if ( Pools_init( &hpools, "handles", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "handles init" );
+    }
+    Pools_set_low_level_zeroed_allocation_function( &hpools, calloc );
+    if ( Pools_add( &hpools, 24, 8 ) || Pools_add( &hpools, 96, 8 ) || Pools_enable_handle_generations( &hpools ) )
+    {
+        POOL_ABORT( "handles add" );
+    }
+
+    /* handles spill to the larger class but never to the heap */
+    for ( i = 0; i < 16; ++i )
+    {
+        size_t *p;
+        handles[i] = Pools_allocate_handle( &hpools, 20 );
+        p = (size_t *)Pools_handle_to_ptr( &hpools, handles[i] );
+        if ( handles[i] == POOL_HANDLE_INVALID || p == 0 || Pools_find_pool_for_address( &hpools, p ) != &hpools.pool[i / 8] )
+        {
+            POOL_ABORT( "allocate handle" );
+        }
+        *p = i;
+    }
+    if ( Pools_allocate_handle( &hpools, 20 ) != POOL_HANDLE_INVALID || hpools.diag_num_spills_to_heap != 0
+         || Pools_handle_to_ptr( &hpools, POOL_HANDLE_INVALID ) != 0 )
+    {
+        POOL_ABORT( "handle from a full Pools" );
+    }
+
+    /* a freed handle no longer resolves, even once its element is reused */
+    stale = handles[3];
+    Pools_deallocate_handle( &hpools, stale );
+    handles[3] = Pools_allocate_handle( &hpools, 20 );
+    if ( Pools_handle_to_ptr( &hpools, stale ) != 0
+         || Pools_handle_to_ptr( &hpools, handles[3] ) != Pool_get_address_for_element( &hpools.pool[0], 3 ) )
+    {
+        POOL_ABORT( "stale handle" );
+    }
+    *(size_t *)Pools_handle_to_ptr( &hpools, handles[3] ) = 3;
+
+    /* a pool inserted between the classes, as the maintainer does, moves the larger class without breaking its handles */
+    if ( Pools_init_pool( &hpools, &grown, 24, 8 ) || Pools_insert_pool( &hpools, &grown )
+         || hpools.pool[1].handle_id != 2 || hpools.pool[1].generations == 0 || hpools.pool[2].element_size != 96 )
+    {
+        POOL_ABORT( "handles grow" );
+    }
+    for ( i = 0; i < 16; ++i )
+    {
+        if ( *(size_t *)Pools_handle_to_ptr( &hpools, handles[i] ) != i )
+        {
+            POOL_ABORT( "handle after the pool moved" );
+        }
+        Pools_deallocate_handle( &hpools, handles[i] );
+    }
+
+    /* POOL_HANDLE_INVALID does not resolve even in a pool with id 15 that is larger than handles can address */
+    {
+        struct Pool large;
+        uint64_t *flags = (uint64_t *)calloc( 1, Pool_allocated_flags_size( POOL_HANDLE_MAX_ELEMENTS + 1 ) );
+        Pool_init_view( &large, POOL_HANDLE_MAX_ELEMENTS + 1, 8, flags, (unsigned char *)(uintptr_t)0x100000 );
+        large.handle_id = ( 1u << POOL_HANDLE_ID_BITS ) - 1;
+        if ( flags == 0 || Pool_handle_to_ptr( &large, POOL_HANDLE_INVALID ) != 0
+             || Pool_handle_to_ptr( &large, POOL_HANDLE_INVALID - 1 ) == 0 )
+        {
+            POOL_ABORT( "invalid handle resolved" );
+        }
+        Pool_terminate( &large );
+        free( flags );
+    }
+
+    /* the pool that replaces a removed one gets a new id, so the handles of the removed pool stay stale */
+    stale = Pool_allocate_handle( &hpools.pool[1] );
+    Pools_remove_pool( &hpools, 1, &grown );
+    Pool_terminate( &grown );
+    if ( Pools_init_pool( &hpools, &grown, 24, 8 ) || Pools_insert_pool( &hpools, &grown )
+         || hpools.pool[1].handle_id != 3 || Pool_allocate_handle( &hpools.pool[1] ) == POOL_HANDLE_INVALID
+         || Pools_handle_to_ptr( &hpools, stale ) != 0 )
+    {
+        POOL_ABORT( "handle id reused" );
+    }
+    Pools_terminate( &hpools );
+}
+
+static void *failing_reallocation( void *p, size_t size )
+{
+    (void)p;
+    (void)size;
+    return 0;
+}
+
+/* a heap reallocation that fails leaves the item alone and is not counted as a move */
+void exercise_failed_reallocate()
+{
+    void *p = Pools_allocate_element( &my_pools, 10000 );
+    size_t moved = my_pools.diag_num_reallocs_moved;
+    Pools_set_low_level_reallocation_function( &my_pools, failing_reallocation );
+    if ( Pools_find_pool_for_address( &my_pools, p ) || Pools_reallocate( &my_pools, p, 10000, 20000 ) != 0
+         || my_pools.diag_num_reallocs_moved != moved )
+    {
+        POOL_ABORT( "failed reallocate counted as a move" );
+    }
+    Pools_set_low_level_reallocation_function( &my_pools, 0 );
+    Pools_deallocate_element( &my_pools, p );
+}
+
+void exercise_reallocate()
+{
+    size_t i;
+    size_t len = 1;
+    unsigned char *p = (unsigned char *)Pools_allocate_element( &my_pools, len );
+    p[0] = 0;
+
+    /* grow one byte at a time past the largest class so that every path is taken */
+    while ( len < 10000 )
+    {
+        unsigned char *q = (unsigned char *)Pools_reallocate( &my_pools, p, len, len + 1 );
+        if ( q == 0 )
+        {
+            POOL_ABORT( "reallocate" );
+        }
+        if ( q != p && Pools_find_pool_for_address( &my_pools, p ) && len < 64 )
+        {
+            POOL_ABORT( "reallocate moved an item that fit in its element" );
+        }
+        p = q;
+        p[len] = (unsigned char)len;
+        ++len;
+    }
+    for ( i = 0; i < len; ++i )
+    {
+        if ( p[i] != (unsigned char)i )
+        {
+            POOL_ABORT( "reallocate lost contents" );
+        }
+    }
+    p = (unsigned char *)Pools_reallocate( &my_pools, p, len, 16 );
+    for ( i = 0; i < 16; ++i )
+    {
+        if ( p[i] != (unsigned char)i )
+        {
+            POOL_ABORT( "reallocate lost contents when shrinking" );
+        }
+    }
+    if ( Pools_reallocate( &my_pools, p, 16, 0 ) != 0 )
+    {
+        POOL_ABORT( "reallocate to 0 should free" );
+    }
+}
+
 int main()
 {
     int r = 255;
@@ -100,6 +643,16 @@ int main()
             POOL_ABORT( "alloc" );
         }
         exercise_pool();
+        exercise_placement_policies();
+        exercise_address_mapping();
+        exercise_for_each_allocated();
+        exercise_zeroed();
+        exercise_placed();
+        exercise_handles();
+        exercise_reallocate();
+        exercise_failed_reallocate();
+        Pools_set_low_level_reallocation_function( &my_pools, realloc );
+        exercise_reallocate();
 
         Pools_terminate( &my_pools );
     }
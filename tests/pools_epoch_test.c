@@ -0,0 +1,187 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "pools.h"
+
+struct Pools my_pools;
+
+void *my_low_level_allocation( size_t sz ) { return malloc( (size_t)sz ); }
+
+void my_low_level_free( void *p ) { free( p ); }
+
+#define NUM_READERS ( 3 )
+#define NUM_UPDATES ( 200000 )
+
+struct Node
+{
+    size_t value;
+    size_t check;
+};
+
+static struct Node *current;
+static int stop_readers;
+static size_t num_torn_reads;
+
+void *reader( void *arg )
+{
+    struct Pools_epoch_thread *thread = Pools_epoch_register( &my_pools );
+    volatile size_t spin;
+    (void)arg;
+    if ( thread == 0 )
+    {
+        POOL_ABORT( "register" );
+    }
+    while ( !__atomic_load_n( &stop_readers, __ATOMIC_ACQUIRE ) )
+    {
+        struct Node *node;
+        size_t value;
+        Pools_epoch_enter( &my_pools, thread );
+        node = __atomic_load_n( &current, __ATOMIC_ACQUIRE );
+        value = __atomic_load_n( &node->value, __ATOMIC_RELAXED );
+        for ( spin = 0; spin < 100; ++spin )
+        {
+        }
+        if ( __atomic_load_n( &node->check, __ATOMIC_RELAXED ) != ~value )
+        {
+            __atomic_fetch_add( &num_torn_reads, 1, __ATOMIC_RELAXED );
+        }
+        Pools_epoch_exit( &my_pools, thread );
+    }
+    Pools_epoch_unregister( &my_pools, thread );
+    return 0;
+}
+
+static struct Node *make_node( size_t value )
+{
+    struct Node *r = Pools_allocate_element( &my_pools, sizeof( struct Node ) );
+    __atomic_store_n( &r->value, value, __ATOMIC_RELAXED );
+    __atomic_store_n( &r->check, ~value, __ATOMIC_RELAXED );
+    return r;
+}
+
+int main()
+{
+    struct Pools_epoch_thread *a;
+    struct Pools_epoch_thread *b;
+    pthread_t readers[NUM_READERS];
+    void *p;
+    size_t i;
+
+    if ( Pools_init( &my_pools, "epoch", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    if ( Pools_add( &my_pools, 16, 256 ) )
+    {
+        POOL_ABORT( "alloc" );
+    }
+
+    /* an item retired while a reader is inside a critical section outlives it */
+    a = Pools_epoch_register( &my_pools );
+    b = Pools_epoch_register( &my_pools );
+    if ( a == 0 || b == 0 || a == b )
+    {
+        POOL_ABORT( "register" );
+    }
+    p = Pools_allocate_element( &my_pools, 16 );
+    Pools_epoch_enter( &my_pools, a );
+    Pools_epoch_enter( &my_pools, a );
+    Pools_epoch_exit( &my_pools, a );
+    if ( Pools_retire( &my_pools, b, p ) )
+    {
+        POOL_ABORT( "retire" );
+    }
+    for ( i = 0; i < 10; ++i )
+    {
+        if ( Pools_epoch_reclaim( &my_pools, b ) != 0 )
+        {
+            POOL_ABORT( "reclaimed under a reader" );
+        }
+    }
+    if ( Pool_count_allocated( &my_pools.pool[0] ) != 1 )
+    {
+        POOL_ABORT( "freed under a reader" );
+    }
+    Pools_epoch_exit( &my_pools, a );
+    for ( i = 0; i < 3 && Pool_count_allocated( &my_pools.pool[0] ) != 0; ++i )
+    {
+        Pools_epoch_reclaim( &my_pools, b );
+    }
+    if ( Pool_count_allocated( &my_pools.pool[0] ) != 0 || my_pools.epoch.diag_num_reclaimed != 1 )
+    {
+        POOL_ABORT( "not reclaimed after the reader left" );
+    }
+
+    /* released records are handed to the next thread that registers */
+    Pools_epoch_unregister( &my_pools, a );
+    if ( Pools_epoch_register( &my_pools ) != a )
+    {
+        POOL_ABORT( "record not reused" );
+    }
+    Pools_epoch_unregister( &my_pools, a );
+
+    /* readers racing a writer that swaps and retires the node they read never see it reused */
+    current = make_node( 0 );
+    for ( i = 0; i < NUM_READERS; ++i )
+    {
+        pthread_create( &readers[i], 0, reader, 0 );
+    }
+    for ( i = 1; i <= NUM_UPDATES; ++i )
+    {
+        struct Node *old = __atomic_exchange_n( &current, make_node( i ), __ATOMIC_ACQ_REL );
+        if ( Pools_retire( &my_pools, b, old ) )
+        {
+            POOL_ABORT( "retire" );
+        }
+    }
+    __atomic_store_n( &stop_readers, 1, __ATOMIC_RELEASE );
+    for ( i = 0; i < NUM_READERS; ++i )
+    {
+        pthread_join( readers[i], 0 );
+    }
+    if ( num_torn_reads != 0 )
+    {
+        printf( "torn reads: %zu\n", num_torn_reads );
+        POOL_ABORT( "a node was reused while it was being read" );
+    }
+    Pools_retire( &my_pools, b, current );
+    for ( i = 0; i < 3; ++i )
+    {
+        Pools_epoch_reclaim( &my_pools, b );
+    }
+    if ( Pool_count_allocated( &my_pools.pool[0] ) != 0
+         || my_pools.epoch.diag_num_reclaimed != my_pools.epoch.diag_num_retired )
+    {
+        POOL_ABORT( "retired nodes leaked" );
+    }
+
+    Pools_diagnostics( &my_pools, "epoch", puts );
+    Pools_terminate( &my_pools );
+    return 0;
+}
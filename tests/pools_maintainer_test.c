@@ -0,0 +1,286 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <time.h>
+#include "pools_maintainer.h"
+
+struct Pools my_pools;
+struct PoolsMaintainer my_maintainer;
+
+void *my_low_level_allocation( size_t sz ) { return malloc( (size_t)sz ); }
+
+void my_low_level_free( void *p ) { free( p ); }
+
+#define CLASS_ELEMENTS ( 100 )
+
+static void *items[4 * CLASS_ELEMENTS];
+static size_t low_memory_calls;
+
+static void on_low_memory( void *context, struct Pools *pools )
+{
+    if ( context != &low_memory_calls || pools != &my_pools )
+    {
+        POOL_ABORT( "low memory callback arguments" );
+    }
+    ++low_memory_calls;
+}
+
+static size_t pools_of_size( size_t element_size )
+{
+    size_t r = 0;
+    size_t i;
+    /* only the owner changes the pool array, and the test runs on the owner thread */
+    for ( i = 0; i < my_pools.num_pools; ++i )
+    {
+        if ( my_pools.pool[i].element_size == element_size )
+        {
+            ++r;
+        }
+    }
+    return r;
+}
+
+static void allocate_items( size_t first, size_t count )
+{
+    size_t i;
+    for ( i = first; i < first + count; ++i )
+    {
+        items[i] = Pools_allocate_element( &my_pools, 48 );
+    }
+}
+
+static void *free_items_remotely( void *arg )
+{
+    size_t i;
+    (void)arg;
+    for ( i = 0; i < 4 * CLASS_ELEMENTS; ++i )
+    {
+        Pools_deallocate_element( &my_pools, items[i] );
+    }
+    return 0;
+}
+
+static void free_items( size_t first, size_t count )
+{
+    size_t i;
+    for ( i = first; i < first + count; ++i )
+    {
+        Pools_deallocate_element( &my_pools, items[i] );
+    }
+}
+
+static size_t passes( void )
+{
+    size_t r;
+    pthread_mutex_lock( &my_maintainer.lock );
+    r = my_maintainer.diag_num_passes;
+    pthread_mutex_unlock( &my_maintainer.lock );
+    return r;
+}
+
+/* wait for the maintenance thread to start and finish at least one whole pass after this call, or give up after 10s */
+static void wait_for_whole_pass( void )
+{
+    struct timespec ts;
+    size_t start = passes();
+    size_t i;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000L;
+    for ( i = 0; i < 10000 && passes() < start + 2; ++i )
+    {
+        nanosleep( &ts, 0 );
+    }
+    if ( passes() < start + 2 )
+    {
+        POOL_ABORT( "maintenance thread stalled" );
+    }
+}
+
+int main()
+{
+    size_t i;
+
+    if ( Pools_init( &my_pools, "maintained", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    if ( Pools_add( &my_pools, 64, CLASS_ELEMENTS ) || Pools_add( &my_pools, 256, CLASS_ELEMENTS ) )
+    {
+        POOL_ABORT( "alloc" );
+    }
+    if ( PoolsMaintainer_init( &my_maintainer, &my_pools, 1, 75, 2 )
+         || PoolsMaintainer_add_low_memory_callback( &my_maintainer, on_low_memory, &low_memory_calls ) )
+    {
+        POOL_ABORT( "maintainer init" );
+    }
+
+    /* below the watermark nothing happens */
+    allocate_items( 0, 70 );
+    PoolsMaintainer_run_once( &my_maintainer );
+    if ( my_pools.num_pools != 2 )
+    {
+        POOL_ABORT( "grew below the watermark" );
+    }
+
+    /* above it the class gets a second pool, inserted before the larger class */
+    allocate_items( 70, 10 );
+    PoolsMaintainer_run_once( &my_maintainer );
+    if ( my_pools.num_pools != 3 || my_pools.pool[1].element_size != 64 || my_pools.pool[2].element_size != 256 )
+    {
+        POOL_ABORT( "grow" );
+    }
+    allocate_items( 80, 100 );
+    PoolsMaintainer_run_once( &my_maintainer );
+    if ( pools_of_size( 64 ) != 3 || my_pools.pool[my_pools.num_pools - 1].total_allocated_items != 0
+         || my_pools.diag_num_spills_to_heap != 0 )
+    {
+        POOL_ABORT( "grown pools were not used" );
+    }
+
+    /* after the burst the grown pools are released once they have been idle for two passes */
+    free_items( 0, 180 );
+    PoolsMaintainer_run_once( &my_maintainer );
+    if ( pools_of_size( 64 ) != 3 )
+    {
+        POOL_ABORT( "trimmed too early" );
+    }
+    PoolsMaintainer_run_once( &my_maintainer );
+    if ( pools_of_size( 64 ) != 1 || my_maintainer.diag_num_trims != 2 || my_maintainer.num_grown != 0 )
+    {
+        POOL_ABORT( "trim" );
+    }
+
+    /* low memory releases idle grown pools at once and runs the callbacks instead of growing */
+    allocate_items( 0, 80 );
+    PoolsMaintainer_run_once( &my_maintainer );
+    free_items( 0, 80 );
+    PoolsMaintainer_notify_low_memory( &my_maintainer );
+    PoolsMaintainer_run_once( &my_maintainer );
+    if ( low_memory_calls != 1 || pools_of_size( 64 ) != 1 )
+    {
+        POOL_ABORT( "low memory" );
+    }
+
+    /* with the thread running, a ramp is absorbed by pools grown in the background */
+    if ( PoolsMaintainer_start( &my_maintainer ) )
+    {
+        POOL_ABORT( "start" );
+    }
+    for ( i = 0; i < 4 * CLASS_ELEMENTS; i += 10 )
+    {
+        /* the pools grown during the wait are inserted by the first allocation of the next batch */
+        allocate_items( i, 10 );
+        wait_for_whole_pass();
+    }
+    if ( pools_of_size( 64 ) < 4 || my_pools.diag_num_spills_to_heap != 0 )
+    {
+        POOL_ABORT( "background grow" );
+    }
+    free_items( 0, 4 * CLASS_ELEMENTS );
+    for ( i = 0; i < 100 && pools_of_size( 64 ) != 1; ++i )
+    {
+        wait_for_whole_pass();
+        PoolsMaintainer_apply( &my_maintainer );
+    }
+    if ( pools_of_size( 64 ) != 1 )
+    {
+        POOL_ABORT( "background trim" );
+    }
+
+    /* another thread frees the items while the owner keeps inserting and removing pools under its lookups */
+    for ( i = 0; i < 4 * CLASS_ELEMENTS; i += 10 )
+    {
+        allocate_items( i, 10 );
+        wait_for_whole_pass();
+    }
+    {
+        pthread_t thread;
+        void *extra[CLASS_ELEMENTS];
+        size_t j;
+        if ( pthread_create( &thread, 0, free_items_remotely, 0 ) )
+        {
+            POOL_ABORT( "pthread_create" );
+        }
+        for ( i = 0; i < 100; ++i )
+        {
+            for ( j = 0; j < CLASS_ELEMENTS; ++j )
+            {
+                extra[j] = Pools_allocate_element( &my_pools, 200 );
+            }
+            for ( j = 0; j < CLASS_ELEMENTS; ++j )
+            {
+                Pools_deallocate_element( &my_pools, extra[j] );
+            }
+            PoolsMaintainer_apply( &my_maintainer );
+        }
+        pthread_join( thread, 0 );
+    }
+    for ( i = 0; i < 100 && pools_of_size( 64 ) != 1; ++i )
+    {
+        Pools_drain_remote_frees( &my_pools );
+        wait_for_whole_pass();
+        PoolsMaintainer_apply( &my_maintainer );
+    }
+    if ( pools_of_size( 64 ) != 1 || my_pools.diag_num_remote_frees != 4 * CLASS_ELEMENTS )
+    {
+        POOL_ABORT( "remote frees while maintained" );
+    }
+    PoolsMaintainer_stop( &my_maintainer );
+
+    /* while another thread is still looking up pools nothing is released, and once retired_pool is full the owner leaves
+     * further trims pending instead of retiring more pools */
+    __atomic_add_fetch( &my_pools.num_layout_readers, 1, __ATOMIC_SEQ_CST );
+    for ( i = 0; i < 2 * POOLS_MAINTAINER_MAX_RETIRED; ++i )
+    {
+        allocate_items( 0, 80 );
+        PoolsMaintainer_run_once( &my_maintainer );
+        free_items( 0, 80 );
+        PoolsMaintainer_run_once( &my_maintainer );
+        PoolsMaintainer_run_once( &my_maintainer );
+    }
+    if ( my_maintainer.num_retired != POOLS_MAINTAINER_MAX_RETIRED || my_maintainer.num_trim_requests != 1
+         || !my_maintainer.work_pending || pools_of_size( 64 ) != 2 )
+    {
+        POOL_ABORT( "retired pools while a reader was active" );
+    }
+    __atomic_sub_fetch( &my_pools.num_layout_readers, 1, __ATOMIC_SEQ_CST );
+    PoolsMaintainer_run_once( &my_maintainer );
+    PoolsMaintainer_run_once( &my_maintainer );
+    if ( my_maintainer.num_retired != 0 || my_maintainer.work_pending || pools_of_size( 64 ) != 1 )
+    {
+        POOL_ABORT( "pending trim after the reader left" );
+    }
+
+    PoolsMaintainer_diagnostics( &my_maintainer, "maintained", puts );
+    Pools_diagnostics( &my_pools, "maintained", puts );
+    Pools_terminate( &my_pools );
+    if ( my_pools.maintainer != 0 )
+    {
+        POOL_ABORT( "terminate" );
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <pthread.h>
+#include "pools_numa.h"
+
+struct PoolsNuma my_pools;
+
+void *my_low_level_allocation( size_t sz ) { return malloc( (size_t)sz ); }
+
+void my_low_level_free( void *p ) { free( p ); }
+
+#define NUMA_WORKERS ( 4 )
+#define NUMA_COUNT ( 2048 )
+
+void *ptrs[NUMA_WORKERS][NUMA_COUNT];
+
+void *allocate_worker( void *arg )
+{
+    size_t w = (size_t)arg;
+    size_t i;
+    for ( i = 0; i < NUMA_COUNT; ++i )
+    {
+        ptrs[w][i] = PoolsNuma_allocate_element( &my_pools, ( i * 13 ) % 600 );
+    }
+    return 0;
+}
+
+void *free_worker( void *arg )
+{
+    /* free the items another worker allocated so that frees have to be routed to the owning node */
+    size_t w = ( (size_t)arg + 1 ) % NUMA_WORKERS;
+    size_t i;
+    for ( i = 0; i < NUMA_COUNT; ++i )
+    {
+        PoolsNuma_deallocate_element( &my_pools, ptrs[w][i] );
+    }
+    return 0;
+}
+
+static pthread_barrier_t attached_barrier;
+
+void *attached_worker( void *arg )
+{
+    /* allocate from the thread's own Pools, free another worker's items into its remote free list, then take back the
+     * items the other workers freed */
+    size_t w = (size_t)arg;
+    size_t i;
+    struct Pools *pools;
+    if ( PoolsNuma_attach_thread( &my_pools ) )
+    {
+        POOL_ABORT( "attach" );
+    }
+    pools = PoolsNuma_thread_pools( &my_pools );
+    for ( i = 0; i < NUMA_COUNT; ++i )
+    {
+        ptrs[w][i] = PoolsNuma_allocate_element( &my_pools, ( i * 13 ) % 600 );
+    }
+    pthread_barrier_wait( &attached_barrier );
+    for ( i = 0; i < NUMA_COUNT; ++i )
+    {
+        PoolsNuma_deallocate_element( &my_pools, ptrs[( w + 1 ) % NUMA_WORKERS][i] );
+    }
+    pthread_barrier_wait( &attached_barrier );
+    Pools_drain_remote_frees( pools );
+    for ( i = 0; i < pools->num_pools; ++i )
+    {
+        if ( pools->pool[i].total_allocated_items != 0 )
+        {
+            POOL_ABORT( "items were not returned to their thread" );
+        }
+    }
+    PoolsNuma_detach_thread( &my_pools );
+    if ( PoolsNuma_thread_pools( &my_pools ) != 0 )
+    {
+        POOL_ABORT( "detach" );
+    }
+    return 0;
+}
+
+void run_workers( void *( *worker )( void * ) )
+{
+    pthread_t threads[NUMA_WORKERS];
+    size_t w;
+    for ( w = 0; w < NUMA_WORKERS; ++w )
+    {
+        if ( pthread_create( &threads[w], 0, worker, (void *)w ) )
+        {
+            POOL_ABORT( "pthread_create" );
+        }
+    }
+    for ( w = 0; w < NUMA_WORKERS; ++w )
+    {
+        pthread_join( threads[w], 0 );
+    }
+}
+
+int main()
+{
+    size_t n;
+    size_t i;
+    if ( PoolsNuma_init( &my_pools, "numa", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    if ( PoolsNuma_add( &my_pools, 64, 2048 ) || PoolsNuma_add( &my_pools, 256, 2048 ) )
+    {
+        POOL_ABORT( "alloc" );
+    }
+
+    run_workers( allocate_worker );
+    run_workers( free_worker );
+
+    for ( n = 0; n < my_pools.num_nodes; ++n )
+    {
+        for ( i = 0; i < my_pools.node[n].num_pools; ++i )
+        {
+            if ( my_pools.node[n].pool[i].total_allocated_items != 0 )
+            {
+                POOL_ABORT( "items were not returned to their node" );
+            }
+        }
+    }
+
+    /* attached threads allocate without the node locks, and a second round takes over the Pools of the first */
+    pthread_barrier_init( &attached_barrier, 0, NUMA_WORKERS );
+    run_workers( attached_worker );
+    run_workers( attached_worker );
+    pthread_barrier_destroy( &attached_barrier );
+    if ( my_pools.num_thread_slots != NUMA_WORKERS )
+    {
+        POOL_ABORT( "detached Pools were not taken over" );
+    }
+    for ( i = 0; i < my_pools.num_thread_slots; ++i )
+    {
+        if ( my_pools.thread_state[i] != POOLS_NUMA_THREAD_DETACHED || my_pools.thread_pools[i].num_pools != 2
+             || my_pools.thread_pools[i].diag_num_remote_frees == 0 )
+        {
+            POOL_ABORT( "thread Pools" );
+        }
+    }
+
+#if !defined( POOL_DISABLE_DIAGNOSTICS )
+    PoolsNuma_diagnostics( &my_pools, "numa", puts );
+#endif
+
+    PoolsNuma_terminate( &my_pools );
+    return 0;
+}
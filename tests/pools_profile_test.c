@@ -0,0 +1,196 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <pthread.h>
+#include "pools.h"
+
+struct Pools my_pools;
+
+static size_t smallest_heap_request = ~(size_t)0;
+
+void *my_low_level_allocation( size_t sz )
+{
+    if ( sz < smallest_heap_request )
+    {
+        smallest_heap_request = sz;
+    }
+    return malloc( (size_t)sz );
+}
+
+void my_low_level_free( void *p ) { free( p ); }
+
+#define SMALL_COUNT ( 100000 )
+#define SMALL_SIZE ( 48 )
+#define LARGE_COUNT ( 200 )
+#define LARGE_SIZE ( 5000 )
+#define SAMPLE_INTERVAL ( 4096 )
+
+static void *small_items[SMALL_COUNT];
+static void *large_items[LARGE_COUNT];
+
+/* totals of the report lines, by size class */
+static size_t reported_pool_bytes;
+static size_t reported_heap_bytes;
+static size_t reported_lines;
+
+static int collect( const char *line )
+{
+    const char *value = strrchr( line, ' ' );
+    size_t bytes = value ? (size_t)strtoull( value + 1, 0, 10 ) : 0;
+    puts( line );
+    ++reported_lines;
+    if ( strncmp( line, "pool_64;", 8 ) == 0 )
+    {
+        reported_pool_bytes += bytes;
+    }
+    else if ( strncmp( line, "heap;", 5 ) == 0 )
+    {
+        reported_heap_bytes += bytes;
+    }
+    else
+    {
+        POOL_ABORT( "unexpected size class" );
+    }
+    return 0;
+}
+
+static void report( int live )
+{
+    reported_pool_bytes = 0;
+    reported_heap_bytes = 0;
+    reported_lines = 0;
+    Pools_profile_report( &my_pools.profile, live, collect );
+}
+
+static int roughly( size_t estimate, size_t actual ) { return estimate > actual * 3 / 4 && estimate < actual * 5 / 4; }
+
+__attribute__( ( noinline ) ) void allocate_small( void )
+{
+    size_t i;
+    for ( i = 0; i < SMALL_COUNT; ++i )
+    {
+        small_items[i] = Pools_allocate_element( &my_pools, SMALL_SIZE );
+    }
+}
+
+__attribute__( ( noinline ) ) void allocate_large( void )
+{
+    size_t i;
+    for ( i = 0; i < LARGE_COUNT; ++i )
+    {
+        large_items[i] = Pools_allocate_element( &my_pools, LARGE_SIZE );
+    }
+}
+
+static void *free_remotely( void *p )
+{
+    Pools_deallocate_element( &my_pools, p );
+    return 0;
+}
+
+/* a remote free while profiling links a heap spill through its first word, so even a one byte spill must hold a pointer */
+static void exercise_tiny_remote_spill( void )
+{
+    pthread_t thread;
+    void *p = Pools_allocate_element( &my_pools, 1 );
+    if ( p == 0 || pthread_create( &thread, 0, free_remotely, p ) )
+    {
+        POOL_ABORT( "tiny spill" );
+    }
+    pthread_join( thread, 0 );
+    if ( Pools_drain_remote_frees( &my_pools ) != 1 || smallest_heap_request < sizeof( void * ) )
+    {
+        POOL_ABORT( "tiny heap spill was not rounded up to a pointer" );
+    }
+}
+
+int main()
+{
+    size_t i;
+
+    if ( Pools_init( &my_pools, "profile", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    if ( Pools_add( &my_pools, 64, SMALL_COUNT ) )
+    {
+        POOL_ABORT( "alloc" );
+    }
+    if ( Pools_profile_start( &my_pools, SAMPLE_INTERVAL, 64, 4096 ) )
+    {
+        POOL_ABORT( "profile start" );
+    }
+
+    allocate_small();
+    allocate_large();
+
+    report( 0 );
+    if ( reported_lines < 2 || !roughly( reported_pool_bytes, SMALL_COUNT * SMALL_SIZE )
+         || !roughly( reported_heap_bytes, LARGE_COUNT * LARGE_SIZE ) )
+    {
+        fprintf( stderr, "total: pool %zu heap %zu\n", reported_pool_bytes, reported_heap_bytes );
+        POOL_ABORT( "total estimate" );
+    }
+
+    /* once the small items are gone only the heap spills remain live, while the totals are unchanged */
+    for ( i = 0; i < SMALL_COUNT; ++i )
+    {
+        Pools_deallocate_element( &my_pools, small_items[i] );
+    }
+    report( 1 );
+    if ( reported_pool_bytes != 0 || !roughly( reported_heap_bytes, LARGE_COUNT * LARGE_SIZE ) )
+    {
+        fprintf( stderr, "live: pool %zu heap %zu\n", reported_pool_bytes, reported_heap_bytes );
+        POOL_ABORT( "live estimate" );
+    }
+    report( 0 );
+    if ( !roughly( reported_pool_bytes, SMALL_COUNT * SMALL_SIZE ) )
+    {
+        POOL_ABORT( "total after free" );
+    }
+
+    for ( i = 0; i < LARGE_COUNT; ++i )
+    {
+        Pools_deallocate_element( &my_pools, large_items[i] );
+    }
+    if ( my_pools.profile.num_live != 0 || my_pools.profile.diag_num_dropped_samples != 0 )
+    {
+        POOL_ABORT( "live samples remain" );
+    }
+
+    Pools_diagnostics( &my_pools, "profile", puts );
+    Pools_terminate( &my_pools );
+
+    if ( Pools_init( &my_pools, "profile_tiny", my_low_level_allocation, my_low_level_free )
+         || Pools_profile_start( &my_pools, SAMPLE_INTERVAL, 64, 4096 ) )
+    {
+        POOL_ABORT( "tiny init" );
+    }
+    exercise_tiny_remote_spill();
+    Pools_terminate( &my_pools );
+    return 0;
+}
@@ -0,0 +1,242 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "pools.h"
+
+struct Pools my_pools;
+
+void *my_low_level_allocation( size_t sz ) { return malloc( (size_t)sz ); }
+
+void my_low_level_free( void *p ) { free( p ); }
+
+#define REMOTE_FREE_COUNT ( 4096 )
+#define REMOTE_FREE_ROUNDS ( 64 )
+
+struct Handoff
+{
+    void *ptrs[REMOTE_FREE_COUNT];
+    size_t count;
+};
+
+void *consumer( void *arg )
+{
+    struct Handoff *handoff = (struct Handoff *)arg;
+    size_t i;
+    for ( i = 0; i < handoff->count; ++i )
+    {
+        Pools_deallocate_element( &my_pools, handoff->ptrs[i] );
+    }
+    return 0;
+}
+
+size_t total_allocated_items( struct Pools *self )
+{
+    size_t total = 0;
+    size_t i;
+    for ( i = 0; i < self->num_pools; ++i )
+    {
+        total += self->pool[i].total_allocated_items;
+    }
+    return total;
+}
+
+#define CONCURRENT_COUNT ( 200000 )
+#define CONCURRENT_THREADS ( 4 )
+
+/* the owner publishes each item it allocates; the freeing threads claim them in order as soon as they appear */
+struct Concurrent
+{
+    void *ptrs[CONCURRENT_COUNT];
+    size_t published;
+    size_t next_to_free;
+};
+
+void *concurrent_consumer( void *arg )
+{
+    struct Concurrent *concurrent = (struct Concurrent *)arg;
+    size_t i;
+    while ( ( i = __atomic_fetch_add( &concurrent->next_to_free, 1, __ATOMIC_RELAXED ) ) < CONCURRENT_COUNT )
+    {
+        while ( __atomic_load_n( &concurrent->published, __ATOMIC_ACQUIRE ) <= i )
+        {
+        }
+        Pools_deallocate_element( &my_pools, concurrent->ptrs[i] );
+    }
+    return 0;
+}
+
+/* the owner keeps allocating, and so keeps draining, while several threads push onto the remote free list */
+void exercise_concurrent_remote_frees( void )
+{
+    static struct Concurrent concurrent;
+    pthread_t threads[CONCURRENT_THREADS];
+    size_t i;
+    for ( i = 0; i < CONCURRENT_THREADS; ++i )
+    {
+        if ( pthread_create( &threads[i], 0, concurrent_consumer, &concurrent ) )
+        {
+            POOL_ABORT( "pthread_create" );
+        }
+    }
+    for ( i = 0; i < CONCURRENT_COUNT; ++i )
+    {
+        concurrent.ptrs[i] = Pools_allocate_element( &my_pools, ( i * 7 ) % 300 );
+        __atomic_store_n( &concurrent.published, i + 1, __ATOMIC_RELEASE );
+    }
+    for ( i = 0; i < CONCURRENT_THREADS; ++i )
+    {
+        pthread_join( threads[i], 0 );
+    }
+    Pools_drain_remote_frees( &my_pools );
+    if ( total_allocated_items( &my_pools ) != 0 )
+    {
+        POOL_ABORT( "concurrent remote frees were not returned to their pools" );
+    }
+    for ( i = 0; i < my_pools.num_pools; ++i )
+    {
+        if ( my_pools.pool[i].diag_multiple_deallocation_errors != 0 )
+        {
+            POOL_ABORT( "concurrent remote frees were mistaken for multiple deallocations" );
+        }
+    }
+}
+
+void *double_free( void *arg )
+{
+    Pools_deallocate_element( &my_pools, arg );
+    Pools_deallocate_element( &my_pools, arg );
+    return 0;
+}
+
+void *double_free_handle( void *arg )
+{
+    uint32_t handle = *(uint32_t *)arg;
+    Pools_deallocate_handle( &my_pools, handle );
+    Pools_deallocate_handle( &my_pools, handle );
+    return 0;
+}
+
+/* a second remote free of an element still on the remote free list must be caught instead of linking it in twice */
+void exercise_double_remote_free( int use_handle )
+{
+    int status = 0;
+    pid_t pid = fork();
+    if ( pid == 0 )
+    {
+        pthread_t thread;
+        uint32_t handle = 0;
+        void *p = 0;
+        int r = 0;
+        if ( use_handle )
+        {
+            Pools_enable_handle_generations( &my_pools );
+            handle = Pools_allocate_handle( &my_pools, 64 );
+            r = pthread_create( &thread, 0, double_free_handle, &handle );
+        }
+        else
+        {
+            p = Pools_allocate_element( &my_pools, 64 );
+            r = pthread_create( &thread, 0, double_free, p );
+        }
+        if ( r == 0 )
+        {
+            pthread_join( thread, 0 );
+            Pools_drain_remote_frees( &my_pools );
+            r = my_pools.pool[0].diag_multiple_deallocation_errors == 1 && my_pools.pool[0].total_allocated_items == 0 ? 0 : 1;
+        }
+        _exit( r );
+    }
+    if ( pid < 0 || waitpid( pid, &status, 0 ) != pid )
+    {
+        POOL_ABORT( "fork" );
+    }
+#if defined( POOL_NO_ABORT_ON_ERROR )
+    if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+#else
+    if ( !WIFSIGNALED( status ) || WTERMSIG( status ) != SIGABRT )
+#endif
+    {
+        fprintf( stderr, "double remote free child ended with status %d\n", status );
+        POOL_ABORT( "double remote free was not caught" );
+    }
+}
+
+int main()
+{
+    static struct Handoff handoff;
+    size_t round;
+    size_t i;
+
+    if ( Pools_init( &my_pools, "remote_free", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    if ( Pools_add( &my_pools, 64, 2048 ) || Pools_add( &my_pools, 256, 2048 ) )
+    {
+        POOL_ABORT( "alloc" );
+    }
+
+    for ( round = 0; round < REMOTE_FREE_ROUNDS; ++round )
+    {
+        pthread_t thread;
+        handoff.count = REMOTE_FREE_COUNT;
+        for ( i = 0; i < handoff.count; ++i )
+        {
+            handoff.ptrs[i] = Pools_allocate_element( &my_pools, ( i * 7 ) % 300 );
+        }
+        if ( pthread_create( &thread, 0, consumer, &handoff ) )
+        {
+            POOL_ABORT( "pthread_create" );
+        }
+        pthread_join( thread, 0 );
+    }
+
+    Pools_drain_remote_frees( &my_pools );
+    if ( total_allocated_items( &my_pools ) != 0 )
+    {
+        POOL_ABORT( "remote frees were not returned to their pools" );
+    }
+    if ( my_pools.diag_num_remote_frees == 0 || my_pools.diag_num_remote_drains == 0 )
+    {
+        POOL_ABORT( "remote free path was not exercised" );
+    }
+
+    exercise_concurrent_remote_frees();
+    exercise_double_remote_free( 0 );
+    exercise_double_remote_free( 1 );
+
+#if !defined( POOL_DISABLE_DIAGNOSTICS )
+    Pools_diagnostics( &my_pools, "remote", puts );
+#endif
+
+    Pools_terminate( &my_pools );
+    return 0;
+}
@@ -0,0 +1,178 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "pools.h"
+
+struct Pools my_pools;
+
+void *my_low_level_allocation( size_t sz ) { return malloc( (size_t)sz ); }
+
+void my_low_level_free( void *p ) { free( p ); }
+
+#define BURST ( 100 )
+
+static void *untagged[5];
+static void *tenant1[BURST];
+static void *tenant2[60];
+static void *tenant3[10];
+
+static void expect( unsigned int tag, size_t num_elements, size_t num_bytes, const char *msg )
+{
+    if ( my_pools.tag[tag].num_elements != num_elements || my_pools.tag[tag].num_bytes != num_bytes )
+    {
+        printf( "tag %u: %zu elements %zu bytes\n", tag, my_pools.tag[tag].num_elements, my_pools.tag[tag].num_bytes );
+        POOL_ABORT( msg );
+    }
+}
+
+void *remote_free( void *arg )
+{
+    size_t i;
+    (void)arg;
+    for ( i = 0; i < BURST; ++i )
+    {
+        Pools_deallocate_element( &my_pools, tenant1[i] );
+    }
+    return 0;
+}
+
+int main()
+{
+    pthread_t thread;
+    struct Pool pending;
+    uint32_t handle;
+    size_t i;
+
+    if ( Pools_init( &my_pools, "tags", my_low_level_allocation, my_low_level_free ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    if ( Pools_add( &my_pools, 64, 100 ) || Pools_add( &my_pools, 256, 100 ) )
+    {
+        POOL_ABORT( "alloc" );
+    }
+
+    /* items allocated before tagging is enabled belong to tag 0 */
+    for ( i = 0; i < 5; ++i )
+    {
+        untagged[i] = Pools_allocate_element( &my_pools, 48 );
+    }
+    /* a pool prepared before tagging is enabled, as the maintainer grows a class, gets its tags when it is inserted */
+    if ( Pools_init_pool( &my_pools, &pending, 64, 100 ) || pending.tags != 0 )
+    {
+        POOL_ABORT( "init pending pool" );
+    }
+    if ( Pools_set_tag_budget( &my_pools, 1, 0, 30 ) || Pools_set_tag_budget( &my_pools, 2, 50 * 64, 0 )
+         || Pools_set_tag_budget( &my_pools, POOLS_MAX_TAGS, 0, 0 ) == 0 )
+    {
+        POOL_ABORT( "set budget" );
+    }
+    expect( 0, 5, 5 * 64, "existing items not charged to tag 0" );
+    if ( Pools_insert_pool( &my_pools, &pending ) || my_pools.pool[1].tags == 0 )
+    {
+        POOL_ABORT( "pending pool inserted without tags" );
+    }
+
+    /* a burst past the budget is refused, neither taking the class from the other tags nor spilling to the heap */
+    for ( i = 0; i < BURST; ++i )
+    {
+        tenant1[i] = Pools_allocate_tagged( &my_pools, 48, 1 );
+        if ( ( tenant1[i] == 0 ) != ( i >= 30 ) )
+        {
+            POOL_ABORT( "element budget not enforced" );
+        }
+    }
+    for ( i = 0; i < 60; ++i )
+    {
+        tenant2[i] = Pools_allocate_tagged( &my_pools, 48, 2 );
+        if ( ( tenant2[i] == 0 ) != ( i >= 50 ) )
+        {
+            POOL_ABORT( "byte budget not enforced" );
+        }
+    }
+    for ( i = 0; i < 10; ++i )
+    {
+        tenant3[i] = Pools_allocate_tagged( &my_pools, 48, 3 );
+        if ( Pools_find_pool_for_address( &my_pools, tenant3[i] ) != &my_pools.pool[0] )
+        {
+            POOL_ABORT( "a burst pushed another tag out of its class" );
+        }
+    }
+    expect( 1, 30, 30 * 64, "element budget" );
+    expect( 2, 50, 50 * 64, "byte budget" );
+    expect( 3, 10, 10 * 64, "unlimited tag" );
+    if ( my_pools.tag[1].diag_num_over_budget != 70 || my_pools.tag[2].diag_num_over_budget != 10
+         || my_pools.diag_num_spills_to_heap != 0 )
+    {
+        POOL_ABORT( "over budget allocations" );
+    }
+
+    /* frees from other threads are charged back when the owner drains them */
+    pthread_create( &thread, 0, remote_free, 0 );
+    pthread_join( thread, 0 );
+    Pools_drain_remote_frees( &my_pools );
+    expect( 1, 0, 0, "remote frees not charged back" );
+
+    /* a reallocation that moves to a larger class stays with its tag */
+    tenant3[0] = Pools_reallocate( &my_pools, tenant3[0], 48, 200 );
+    expect( 3, 10, 9 * 64 + 256, "reallocate lost the tag" );
+
+    /* untagged handles are charged to tag 0, and tagged handles to their tag within its budget */
+    handle = Pools_allocate_handle( &my_pools, 48 );
+    expect( 0, 6, 6 * 64, "handle not charged" );
+    Pools_deallocate_handle( &my_pools, handle );
+    handle = Pools_allocate_handle_tagged( &my_pools, 48, 3 );
+    expect( 3, 11, 10 * 64 + 256, "tagged handle not charged" );
+    Pools_deallocate_handle( &my_pools, handle );
+    expect( 3, 10, 9 * 64 + 256, "tagged handle not charged back" );
+    if ( Pools_allocate_handle_tagged( &my_pools, 48, 2 ) != POOL_HANDLE_INVALID )
+    {
+        POOL_ABORT( "handle over budget" );
+    }
+
+    Pools_diagnostics( &my_pools, "tags", puts );
+    for ( i = 0; i < 5; ++i )
+    {
+        Pools_deallocate_element( &my_pools, untagged[i] );
+    }
+    for ( i = 0; i < 60; ++i )
+    {
+        Pools_deallocate_element( &my_pools, tenant2[i] );
+    }
+    for ( i = 0; i < 10; ++i )
+    {
+        Pools_deallocate_element( &my_pools, tenant3[i] );
+    }
+    for ( i = 0; i < POOLS_MAX_TAGS; ++i )
+    {
+        expect( (unsigned int)i, 0, 0, "occupancy left after freeing everything" );
+    }
+    Pools_terminate( &my_pools );
+    return 0;
+}
@@ -0,0 +1,173 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pools.h"
+
+struct Pools my_pools;
+
+void *my_low_level_allocation( size_t sz ) { return malloc( (size_t)sz ); }
+
+void my_low_level_free( void *p ) { free( p ); }
+
+#define TRACE_CAPACITY ( 1000 )
+#define TRACE_ITEMS ( 300 )
+
+void check_trace( const char *path, uint64_t expected_head, void *const *ptrs )
+{
+    struct stat st;
+    int fd = open( path, O_RDONLY );
+    struct Pools_trace_header *header;
+    struct Pools_trace_record *records;
+    uint64_t first;
+    uint64_t i;
+    if ( fd < 0 || fstat( fd, &st ) != 0 )
+    {
+        POOL_ABORT( "trace file missing" );
+    }
+    header = (struct Pools_trace_header *)mmap( 0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( header == MAP_FAILED || header->magic != POOLS_TRACE_MAGIC || header->capacity != TRACE_CAPACITY
+         || header->head != expected_head )
+    {
+        POOL_ABORT( "trace header" );
+    }
+    records = (struct Pools_trace_record *)( header + 1 );
+
+    /* the ring holds the last TRACE_CAPACITY records of alternating phases of TRACE_ITEMS allocations and deallocations */
+    first = expected_head - TRACE_CAPACITY;
+    for ( i = first; i < expected_head; ++i )
+    {
+        struct Pools_trace_record *record = &records[i % TRACE_CAPACITY];
+        uint64_t phase = i / TRACE_ITEMS;
+        size_t item = (size_t)( i % TRACE_ITEMS );
+        int op = ( phase & 1 ) == 0 ? POOLS_TRACE_ALLOCATE : POOLS_TRACE_DEALLOCATE;
+        if ( record->op != op || record->thread == 0 )
+        {
+            POOL_ABORT( "trace record op" );
+        }
+        if ( i + TRACE_ITEMS >= expected_head && record->object_id != (uint64_t)(uintptr_t)ptrs[item] )
+        {
+            POOL_ABORT( "trace record object_id" );
+        }
+        if ( op == POOLS_TRACE_ALLOCATE && record->size != item * 5 )
+        {
+            POOL_ABORT( "trace record size" );
+        }
+    }
+    munmap( header, (size_t)st.st_size );
+}
+
+/* an in place resize is recorded as a free and an allocation of the new size, so a replay follows the new size */
+void check_resize_trace( const char *path, void *p )
+{
+    static const int ops[3] = {POOLS_TRACE_ALLOCATE, POOLS_TRACE_DEALLOCATE, POOLS_TRACE_ALLOCATE};
+    static const uint64_t sizes[3] = {10, 0, 40};
+    struct stat st;
+    int fd = open( path, O_RDONLY );
+    struct Pools_trace_header *header;
+    struct Pools_trace_record *records;
+    size_t i;
+    if ( fd < 0 || fstat( fd, &st ) != 0 )
+    {
+        POOL_ABORT( "trace file missing" );
+    }
+    header = (struct Pools_trace_header *)mmap( 0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( header == MAP_FAILED || header->head != 3 )
+    {
+        POOL_ABORT( "resize trace header" );
+    }
+    records = (struct Pools_trace_record *)( header + 1 );
+    for ( i = 0; i < 3; ++i )
+    {
+        if ( records[i].op != ops[i] || records[i].object_id != (uint64_t)(uintptr_t)p
+             || ( ops[i] == POOLS_TRACE_ALLOCATE && records[i].size != sizes[i] ) )
+        {
+            POOL_ABORT( "resize trace record" );
+        }
+    }
+    munmap( header, (size_t)st.st_size );
+}
+
+int main()
+{
+    static void *ptrs[TRACE_ITEMS];
+    char path[] = "/tmp/pools_trace_testXXXXXX";
+    int fd = mkstemp( path );
+    size_t round;
+    size_t i;
+
+    if ( fd < 0 )
+    {
+        POOL_ABORT( "mkstemp" );
+    }
+    close( fd );
+    if ( Pools_init( &my_pools, "trace", my_low_level_allocation, my_low_level_free ) || Pools_add( &my_pools, 64, 128 )
+         || Pools_add( &my_pools, 1024, 128 ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    if ( Pools_trace_start( &my_pools, path, TRACE_CAPACITY ) )
+    {
+        POOL_ABORT( "trace start" );
+    }
+    /* allocate and free everything three times so that the ring wraps */
+    for ( round = 0; round < 3; ++round )
+    {
+        for ( i = 0; i < TRACE_ITEMS; ++i )
+        {
+            ptrs[i] = Pools_allocate_element( &my_pools, i * 5 );
+        }
+        for ( i = 0; i < TRACE_ITEMS; ++i )
+        {
+            Pools_deallocate_element( &my_pools, ptrs[i] );
+        }
+    }
+    Pools_trace_stop( &my_pools );
+    check_trace( path, TRACE_ITEMS * 6, ptrs );
+
+    if ( Pools_trace_start( &my_pools, path, TRACE_CAPACITY ) )
+    {
+        POOL_ABORT( "trace restart" );
+    }
+    ptrs[0] = Pools_allocate_element( &my_pools, 10 );
+    if ( Pools_reallocate( &my_pools, ptrs[0], 10, 40 ) != ptrs[0] )
+    {
+        POOL_ABORT( "resize in place" );
+    }
+    Pools_trace_stop( &my_pools );
+    check_resize_trace( path, ptrs[0] );
+    Pools_deallocate_element( &my_pools, ptrs[0] );
+
+    Pools_terminate( &my_pools );
+    unlink( path );
+    return 0;
+}
@@ -0,0 +1,135 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Compares the Pool placement policies on an allocation churn workload. For each policy it reports the time per
+ * free+allocate+write cycle, which is dominated by cache misses on the element handed out, the number of pages spanned by
+ * the live set afterwards, and the time per read when walking the live set.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include "pool.h"
+
+#define BENCH_ELEMENT_SIZE ( 64 )
+#define BENCH_NUM_ELEMENTS ( 1 << 20 )
+#define BENCH_LIVE_ELEMENTS ( BENCH_NUM_ELEMENTS / 4 )
+#define BENCH_CHURN_CYCLES ( 1 << 22 )
+#define BENCH_PAGE_SIZE ( 4096 )
+
+static void *live[BENCH_LIVE_ELEMENTS];
+static unsigned char page_used[(size_t)BENCH_NUM_ELEMENTS * BENCH_ELEMENT_SIZE / BENCH_PAGE_SIZE];
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng( void )
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void bench( const char *name, enum Pool_placement_policy policy )
+{
+    struct Pool pool;
+    size_t i;
+    size_t pages = 0;
+    volatile uint64_t sum = 0;
+    double start;
+    double churn_ns;
+    double walk_ns;
+
+    if ( Pool_init( &pool, BENCH_NUM_ELEMENTS, BENCH_ELEMENT_SIZE, malloc, free ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    Pool_set_placement_policy( &pool, policy );
+    rng_state = 88172645463325252ULL;
+
+    for ( i = 0; i < BENCH_LIVE_ELEMENTS; ++i )
+    {
+        live[i] = Pool_allocate_element( &pool );
+    }
+
+    start = now_ns();
+    for ( i = 0; i < BENCH_CHURN_CYCLES; ++i )
+    {
+        size_t j = rng() % BENCH_LIVE_ELEMENTS;
+        Pool_deallocate_element( &pool, live[j] );
+        live[j] = Pool_allocate_element( &pool );
+        memset( live[j], (int)i, BENCH_ELEMENT_SIZE );
+    }
+    churn_ns = ( now_ns() - start ) / BENCH_CHURN_CYCLES;
+
+    start = now_ns();
+    for ( i = 0; i < BENCH_LIVE_ELEMENTS; ++i )
+    {
+        sum += *(uint64_t *)live[i];
+    }
+    walk_ns = ( now_ns() - start ) / BENCH_LIVE_ELEMENTS;
+
+    memset( page_used, 0, sizeof( page_used ) );
+    for ( i = 0; i < BENCH_LIVE_ELEMENTS; ++i )
+    {
+        size_t page = (size_t)( (unsigned char *)live[i] - pool.element_storage ) / BENCH_PAGE_SIZE;
+        if ( !page_used[page] )
+        {
+            page_used[page] = 1;
+            ++pages;
+        }
+    }
+
+    printf( "%-16s churn %7.1f ns/cycle  walk %6.1f ns/read  live set spans %7zu of %7zu pages\n",
+            name,
+            churn_ns,
+            walk_ns,
+            pages,
+            sizeof( page_used ) );
+
+    Pool_terminate( &pool );
+}
+
+int main()
+{
+    printf( "%d live elements of %d bytes in a pool of %d, %d churn cycles\n",
+            BENCH_LIVE_ELEMENTS,
+            BENCH_ELEMENT_SIZE,
+            BENCH_NUM_ELEMENTS,
+            BENCH_CHURN_CYCLES );
+    bench( "lifo", POOL_PLACEMENT_LIFO );
+    bench( "lowest_address", POOL_PLACEMENT_LOWEST_ADDRESS );
+    bench( "round_robin", POOL_PLACEMENT_ROUND_ROBIN );
+    return 0;
+}
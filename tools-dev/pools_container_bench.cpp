@@ -0,0 +1,356 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Compares std::allocator, PoolsAllocator::pools_allocator and std::pmr::polymorphic_allocator over a
+ * PoolsAllocator::pools_memory_resource on container workloads: insert/erase churn on std::map and std::unordered_map,
+ * std::list splicing, vectors of short heap allocated strings and graphs of shared_ptr nodes. Every run happens in a
+ * forked child so that its peak RSS is its own. For the pools variants the spill counters of each size class are printed
+ * from Pools_diagnostics.
+ *
+ * usage: pools_container_bench [scale]
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "PoolsAllocator.hpp"
+
+namespace
+{
+
+size_t bench_scale = 1;
+
+uint64_t rng_state = 88172645463325252ULL;
+
+uint64_t rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+double now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+template <typename Alloc, typename U>
+using rebind_t = typename std::allocator_traits<Alloc>::template rebind_alloc<U>;
+
+/* each workload returns the number of container operations it performed */
+
+template <typename Alloc>
+size_t map_churn( const Alloc &alloc )
+{
+    typedef std::pair<const uint32_t, uint32_t> value_type;
+    std::map<uint32_t, uint32_t, std::less<uint32_t>, rebind_t<Alloc, value_type> > m( ( rebind_t<Alloc, value_type>( alloc ) ) );
+    size_t live = 100000 * bench_scale;
+    size_t cycles = 1000000 * bench_scale;
+    size_t i;
+    for ( i = 0; i < live; ++i )
+    {
+        m.emplace( (uint32_t)rng(), (uint32_t)i );
+    }
+    for ( i = 0; i < cycles; ++i )
+    {
+        auto it = m.lower_bound( (uint32_t)rng() );
+        if ( it != m.end() )
+        {
+            m.erase( it );
+        }
+        m.emplace( (uint32_t)rng(), (uint32_t)i );
+    }
+    return live + 2 * cycles;
+}
+
+template <typename Alloc>
+size_t unordered_map_churn( const Alloc &alloc )
+{
+    typedef std::pair<const uint32_t, uint32_t> value_type;
+    std::unordered_map<uint32_t, uint32_t, std::hash<uint32_t>, std::equal_to<uint32_t>, rebind_t<Alloc, value_type> > m(
+        0, std::hash<uint32_t>(), std::equal_to<uint32_t>(), rebind_t<Alloc, value_type>( alloc ) );
+    size_t live = 100000 * bench_scale;
+    size_t cycles = 1000000 * bench_scale;
+    std::vector<uint32_t> keys( live );
+    size_t i;
+    for ( i = 0; i < live; ++i )
+    {
+        keys[i] = (uint32_t)rng();
+        m.emplace( keys[i], (uint32_t)i );
+    }
+    for ( i = 0; i < cycles; ++i )
+    {
+        size_t j = rng() % live;
+        m.erase( keys[j] );
+        keys[j] = (uint32_t)rng();
+        m.emplace( keys[j], (uint32_t)i );
+    }
+    return live + 2 * cycles;
+}
+
+template <typename Alloc>
+size_t list_splice( const Alloc &alloc )
+{
+    typedef std::list<uint64_t, rebind_t<Alloc, uint64_t> > list_type;
+    rebind_t<Alloc, uint64_t> a( alloc );
+    list_type lists[2] = {list_type( a ), list_type( a )};
+    size_t cycles = 1000000 * bench_scale;
+    size_t i;
+    for ( i = 0; i < 100000 * bench_scale; ++i )
+    {
+        lists[i & 1].push_back( i );
+    }
+    for ( i = 0; i < cycles; ++i )
+    {
+        list_type &from = lists[i & 1];
+        list_type &to = lists[( i & 1 ) ^ 1];
+        auto last = from.begin();
+        std::advance( last, (long)( rng() % 8 ) );
+        to.splice( to.end(), from, from.begin(), last );
+        from.push_back( i );
+        to.pop_front();
+    }
+    return 3 * cycles;
+}
+
+template <typename Alloc>
+size_t short_strings( const Alloc &alloc )
+{
+    typedef std::basic_string<char, std::char_traits<char>, rebind_t<Alloc, char> > string_type;
+    typedef rebind_t<Alloc, string_type> vector_alloc;
+    std::vector<string_type, vector_alloc> v( ( vector_alloc( alloc ) ) );
+    size_t rounds = 20 * bench_scale;
+    size_t count = 50000;
+    size_t r;
+    size_t i;
+    char buf[64];
+    for ( r = 0; r < rounds; ++r )
+    {
+        for ( i = 0; i < count; ++i )
+        {
+            /* 16 to 47 characters: past the small string buffer but well inside the small pool classes */
+            size_t len = 16 + (size_t)( rng() % 32 );
+            memset( buf, 'a' + (int)( i % 26 ), len );
+            v.emplace_back( string_type( buf, len, rebind_t<Alloc, char>( alloc ) ) );
+        }
+        v.clear();
+    }
+    return rounds * count;
+}
+
+template <typename Alloc>
+struct graph_node
+{
+    typedef std::vector<std::shared_ptr<graph_node>, rebind_t<Alloc, std::shared_ptr<graph_node> > > edge_vector;
+
+    explicit graph_node( const Alloc &alloc ) : edges( rebind_t<Alloc, std::shared_ptr<graph_node> >( alloc ) ) {}
+
+    edge_vector edges;
+    uint64_t payload[2];
+};
+
+template <typename Alloc>
+size_t shared_ptr_graph( const Alloc &alloc )
+{
+    typedef graph_node<Alloc> node;
+    rebind_t<Alloc, node> node_alloc( alloc );
+    size_t rounds = 20 * bench_scale;
+    size_t count = 20000;
+    size_t r;
+    size_t i;
+    for ( r = 0; r < rounds; ++r )
+    {
+        std::vector<std::shared_ptr<node> > nodes;
+        nodes.reserve( count );
+        for ( i = 0; i < count; ++i )
+        {
+            nodes.push_back( std::allocate_shared<node>( node_alloc, alloc ) );
+            if ( i > 0 )
+            {
+                /* a tree plus a few extra links so that nodes are shared; edges only point forward so there are no cycles */
+                nodes[rng() % i]->edges.push_back( nodes[i] );
+                if ( i > 16 && ( i & 3 ) == 0 )
+                {
+                    nodes[i - 1 - rng() % 16]->edges.push_back( nodes[i] );
+                }
+            }
+        }
+        std::shared_ptr<node> root = nodes[0];
+        nodes.clear();
+        root.reset();
+    }
+    return rounds * count;
+}
+
+void *bench_allocation( size_t sz ) { return malloc( sz ); }
+
+void bench_free( void *p ) { free( p ); }
+
+void add_bench_pools( Pools *pools )
+{
+    /* roughly 50 MiB of classes sized for the node and string sizes of the workloads */
+    Pools_init( pools, "bench", bench_allocation, bench_free );
+    Pools_add( pools, 16, 262144 * bench_scale );
+    Pools_add( pools, 32, 262144 * bench_scale );
+    Pools_add( pools, 64, 393216 * bench_scale );
+    Pools_add( pools, 128, 32768 * bench_scale );
+    Pools_add( pools, 256, 8192 );
+    Pools_add( pools, 512, 4096 );
+    Pools_add( pools, 1024, 2048 );
+}
+
+int print_spills( const char *line )
+{
+    if ( strstr( line, "spills" ) && !strstr( line, ": 0" ) && !strstr( line, ":0" ) )
+    {
+        printf( "      %s\n", line );
+    }
+    return 0;
+}
+
+double run_timed( const std::function<size_t()> &workload )
+{
+    double start = now_ns();
+    size_t ops = workload();
+    return (double)ops / ( ( now_ns() - start ) / 1e9 );
+}
+
+void report( const char *workload_name, const char *allocator_name, double ops_per_second )
+{
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+    printf( "%-20s %-10s %12.0f ops/s  peak rss %8ld KiB\n", workload_name, allocator_name, ops_per_second, usage.ru_maxrss );
+    fflush( stdout );
+}
+
+template <template <typename> class Workload>
+void bench( const char *name )
+{
+    for ( int variant = 0; variant < 3; ++variant )
+    {
+        pid_t pid;
+        fflush( stdout );
+        pid = fork();
+        if ( pid == 0 )
+        {
+            Pools pools;
+            rng_state = 88172645463325252ULL;
+            if ( variant == 0 )
+            {
+                report( name, "std", run_timed( [] { return Workload<std::allocator<char> >()( std::allocator<char>() ); } ) );
+            }
+            else if ( variant == 1 )
+            {
+                add_bench_pools( &pools );
+                PoolsAllocator::pools_allocator<char> alloc( &pools );
+                report( name, "pools", run_timed( [&] { return Workload<PoolsAllocator::pools_allocator<char> >()( alloc ); } ) );
+                Pools_diagnostics( &pools, "pools", print_spills );
+            }
+            else
+            {
+#if defined( __cpp_lib_memory_resource )
+                add_bench_pools( &pools );
+                PoolsAllocator::pools_memory_resource resource( &pools );
+                std::pmr::polymorphic_allocator<char> alloc( &resource );
+                report(
+                    name, "pmr_pools", run_timed( [&] { return Workload<std::pmr::polymorphic_allocator<char> >()( alloc ); } ) );
+                Pools_diagnostics( &pools, "pmr_pools", print_spills );
+#endif
+            }
+            fflush( stdout );
+            _exit( 0 );
+        }
+        else if ( pid > 0 )
+        {
+            waitpid( pid, 0, 0 );
+        }
+    }
+}
+
+template <typename Alloc>
+struct map_churn_workload
+{
+    size_t operator()( const Alloc &alloc ) { return map_churn( alloc ); }
+};
+
+template <typename Alloc>
+struct unordered_map_churn_workload
+{
+    size_t operator()( const Alloc &alloc ) { return unordered_map_churn( alloc ); }
+};
+
+template <typename Alloc>
+struct list_splice_workload
+{
+    size_t operator()( const Alloc &alloc ) { return list_splice( alloc ); }
+};
+
+template <typename Alloc>
+struct short_strings_workload
+{
+    size_t operator()( const Alloc &alloc ) { return short_strings( alloc ); }
+};
+
+template <typename Alloc>
+struct shared_ptr_graph_workload
+{
+    size_t operator()( const Alloc &alloc ) { return shared_ptr_graph( alloc ); }
+};
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc > 1 )
+    {
+        bench_scale = (size_t)strtoul( argv[1], 0, 10 );
+        if ( bench_scale == 0 )
+        {
+            bench_scale = 1;
+        }
+    }
+    bench<map_churn_workload>( "map_churn" );
+    bench<unordered_map_churn_workload>( "unordered_map_churn" );
+    bench<list_splice_workload>( "list_splice" );
+    bench<short_strings_workload>( "short_strings" );
+    bench<shared_ptr_graph_workload>( "shared_ptr_graph" );
+    return 0;
+}
@@ -0,0 +1,120 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Compares the two ways threads allocate from a PoolsNuma: through the shared Pools of their node, which takes the node's
+ * lock on every allocation and free, and through a Pools of their own after PoolsNuma_attach_thread, which takes none.
+ * Each thread keeps a window of live items and replaces the oldest one per cycle; the time per free+allocate cycle is
+ * reported for each thread count.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include "pools_numa.h"
+
+#define BENCH_MAX_THREADS ( 8 )
+#define BENCH_WINDOW ( 256 )
+#define BENCH_CYCLES ( 1 << 20 )
+
+static struct PoolsNuma bench_pools;
+static int bench_attach;
+
+static double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void *bench_thread( void *arg )
+{
+    void *window[BENCH_WINDOW];
+    size_t i;
+    (void)arg;
+    if ( bench_attach && PoolsNuma_attach_thread( &bench_pools ) )
+    {
+        POOL_ABORT( "attach" );
+    }
+    for ( i = 0; i < BENCH_WINDOW; ++i )
+    {
+        window[i] = PoolsNuma_allocate_element( &bench_pools, 48 );
+    }
+    for ( i = 0; i < BENCH_CYCLES; ++i )
+    {
+        PoolsNuma_deallocate_element( &bench_pools, window[i % BENCH_WINDOW] );
+        window[i % BENCH_WINDOW] = PoolsNuma_allocate_element( &bench_pools, 48 );
+    }
+    for ( i = 0; i < BENCH_WINDOW; ++i )
+    {
+        PoolsNuma_deallocate_element( &bench_pools, window[i] );
+    }
+    if ( bench_attach )
+    {
+        PoolsNuma_detach_thread( &bench_pools );
+    }
+    return 0;
+}
+
+static void bench( const char *name, int attach, size_t num_threads )
+{
+    pthread_t threads[BENCH_MAX_THREADS];
+    double start;
+    size_t t;
+    bench_attach = attach;
+    start = now_ns();
+    for ( t = 0; t < num_threads; ++t )
+    {
+        if ( pthread_create( &threads[t], 0, bench_thread, 0 ) )
+        {
+            POOL_ABORT( "pthread_create" );
+        }
+    }
+    for ( t = 0; t < num_threads; ++t )
+    {
+        pthread_join( threads[t], 0 );
+    }
+    printf( "%-10s %zu threads %7.1f ns/cycle\n", name, num_threads, ( now_ns() - start ) / BENCH_CYCLES );
+}
+
+int main()
+{
+    size_t num_threads;
+    if ( PoolsNuma_init( &bench_pools, "bench", malloc, free )
+         || PoolsNuma_add( &bench_pools, 64, BENCH_MAX_THREADS * BENCH_WINDOW ) )
+    {
+        POOL_ABORT( "init" );
+    }
+    printf( "%zu nodes, %d live items per thread, %d cycles per thread\n", bench_pools.num_nodes, BENCH_WINDOW, BENCH_CYCLES );
+    for ( num_threads = 1; num_threads <= BENCH_MAX_THREADS; num_threads *= 2 )
+    {
+        bench( "node_lock", 0, num_threads );
+        bench( "attached", 1, num_threads );
+    }
+    PoolsNuma_terminate( &bench_pools );
+    return 0;
+}
@@ -0,0 +1,297 @@
+
+/*
+Copyright (c) 2014, Jeff Koftinoff <jeffk@jdkoftinoff.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * pools_replay replays a trace recorded with Pools_trace_start against a Pools layout or against malloc, and reports the
+ * elapsed time, the peak resident set size and the spill counts.
+ *
+ *   pools_replay trace_file malloc
+ *   pools_replay trace_file 64:4096,256:1024,...
+ *
+ * Records from all threads are replayed on one thread in the order they were recorded. Deallocations of items whose
+ * allocation was overwritten in the ring are skipped.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "pools.h"
+
+/* the trace mapping is released in chunks as it is consumed so that it does not count towards the resident set */
+#define REPLAY_CHUNK_RECORDS ( 65536 )
+
+struct ReplayEntry
+{
+    uint64_t object_id;
+    void *p;
+};
+
+struct ReplayMap
+{
+    struct ReplayEntry *entries;
+    size_t mask;
+};
+
+static struct Pools replay_pools;
+static int replay_use_pools = 0;
+
+static void *replay_allocate( size_t size )
+{
+    return replay_use_pools ? Pools_allocate_element( &replay_pools, size ) : malloc( size );
+}
+
+static void replay_deallocate( void *p )
+{
+    if ( replay_use_pools )
+    {
+        Pools_deallocate_element( &replay_pools, p );
+    }
+    else
+    {
+        free( p );
+    }
+}
+
+static size_t replay_hash( uint64_t id, size_t mask )
+{
+    return (size_t)( ( id * 0x9e3779b97f4a7c15ULL ) >> 17 ) & mask;
+}
+
+static void replay_map_insert( struct ReplayMap *map, uint64_t id, void *p )
+{
+    size_t i = replay_hash( id, map->mask );
+    while ( map->entries[i].object_id != 0 && map->entries[i].object_id != id )
+    {
+        i = ( i + 1 ) & map->mask;
+    }
+    map->entries[i].object_id = id;
+    map->entries[i].p = p;
+}
+
+static void *replay_map_remove( struct ReplayMap *map, uint64_t id )
+{
+    size_t i = replay_hash( id, map->mask );
+    size_t j;
+    void *p;
+    while ( map->entries[i].object_id != id )
+    {
+        if ( map->entries[i].object_id == 0 )
+        {
+            return 0;
+        }
+        i = ( i + 1 ) & map->mask;
+    }
+    p = map->entries[i].p;
+    /* backward shift deletion keeps the linear probe chains intact without tombstones */
+    for ( j = ( i + 1 ) & map->mask; map->entries[j].object_id != 0; j = ( j + 1 ) & map->mask )
+    {
+        size_t home = replay_hash( map->entries[j].object_id, map->mask );
+        if ( ( ( j - home ) & map->mask ) >= ( ( j - i ) & map->mask ) )
+        {
+            map->entries[i] = map->entries[j];
+            i = j;
+        }
+    }
+    map->entries[i].object_id = 0;
+    map->entries[i].p = 0;
+    return p;
+}
+
+static int replay_configure( const char *layout )
+{
+    const char *s = layout;
+    Pools_init( &replay_pools, "replay", malloc, free );
+    Pools_set_low_level_reallocation_function( &replay_pools, realloc );
+    while ( *s )
+    {
+        char *end = 0;
+        size_t element_size = strtoul( s, &end, 10 );
+        size_t num_elements;
+        if ( end == s || *end != ':' )
+        {
+            return -1;
+        }
+        s = end + 1;
+        num_elements = strtoul( s, &end, 10 );
+        if ( end == s || Pools_add( &replay_pools, element_size, num_elements ) != 0 )
+        {
+            return -1;
+        }
+        s = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+static void replay_release( void const *from, void const *to )
+{
+    uintptr_t page_size = (uintptr_t)sysconf( _SC_PAGESIZE );
+    uintptr_t start = ( (uintptr_t)from + page_size - 1 ) & ~( page_size - 1 );
+    uintptr_t end = (uintptr_t)to & ~( page_size - 1 );
+    if ( start < end )
+    {
+        madvise( (void *)start, end - start, MADV_DONTNEED );
+    }
+}
+
+static double replay_now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int replay_print( const char *s ) { return puts( s ); }
+
+int main( int argc, char **argv )
+{
+    int fd;
+    struct stat st;
+    struct Pools_trace_header *header;
+    struct Pools_trace_record *records;
+    struct ReplayMap map;
+    uint64_t count;
+    uint64_t first;
+    uint64_t n;
+    size_t map_size = 1;
+    size_t unmatched_frees = 0;
+    size_t leaked = 0;
+    double elapsed_ns;
+    struct rusage usage;
+
+    if ( argc != 3 )
+    {
+        fprintf( stderr, "usage: %s trace_file (malloc | element_size:num_elements,...)\n", argv[0] );
+        return 1;
+    }
+    fd = open( argv[1], O_RDONLY );
+    if ( fd < 0 || fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof( struct Pools_trace_header ) )
+    {
+        fprintf( stderr, "%s: unable to open trace file %s\n", argv[0], argv[1] );
+        return 1;
+    }
+    header = (struct Pools_trace_header *)mmap( 0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( header == MAP_FAILED || header->magic != POOLS_TRACE_MAGIC
+         || sizeof( *header ) + header->capacity * sizeof( struct Pools_trace_record ) > (size_t)st.st_size )
+    {
+        fprintf( stderr, "%s: %s is not a pools trace file\n", argv[0], argv[1] );
+        return 1;
+    }
+    records = (struct Pools_trace_record *)( header + 1 );
+    count = header->head < header->capacity ? header->head : header->capacity;
+    first = header->head - count;
+
+    if ( strcmp( argv[2], "malloc" ) != 0 )
+    {
+        if ( replay_configure( argv[2] ) != 0 )
+        {
+            fprintf( stderr, "%s: invalid pools layout %s\n", argv[0], argv[2] );
+            return 1;
+        }
+        replay_use_pools = 1;
+    }
+
+    while ( map_size < count * 2 )
+    {
+        map_size <<= 1;
+    }
+    map.entries = (struct ReplayEntry *)calloc( map_size, sizeof( struct ReplayEntry ) );
+    map.mask = map_size - 1;
+    if ( map.entries == 0 )
+    {
+        fprintf( stderr, "%s: out of memory\n", argv[0] );
+        return 1;
+    }
+
+    elapsed_ns = replay_now_ns();
+    for ( n = 0; n < count; ++n )
+    {
+        uint64_t index = ( first + n ) % header->capacity;
+        struct Pools_trace_record *record = &records[index];
+        if ( record->op == POOLS_TRACE_ALLOCATE )
+        {
+            void *p = replay_allocate( record->size );
+            if ( p )
+            {
+                memset( p, 0, record->size );
+                replay_map_insert( &map, record->object_id, p );
+            }
+        }
+        else if ( record->op == POOLS_TRACE_DEALLOCATE )
+        {
+            void *p = replay_map_remove( &map, record->object_id );
+            if ( p )
+            {
+                replay_deallocate( p );
+            }
+            else
+            {
+                ++unmatched_frees;
+            }
+        }
+        if ( ( index + 1 ) % REPLAY_CHUNK_RECORDS == 0 )
+        {
+            replay_release( &records[index + 1 - REPLAY_CHUNK_RECORDS], &records[index + 1] );
+        }
+    }
+    elapsed_ns = replay_now_ns() - elapsed_ns;
+
+    for ( n = 0; n <= map.mask; ++n )
+    {
+        if ( map.entries[n].object_id )
+        {
+            ++leaked;
+        }
+    }
+    getrusage( RUSAGE_SELF, &usage );
+
+    printf( "records               : %llu\n", (unsigned long long)count );
+    printf( "records_overwritten   : %llu\n", (unsigned long long)first );
+    printf( "unmatched_frees       : %zu\n", unmatched_frees );
+    printf( "items_still_allocated : %zu\n", leaked );
+    printf( "elapsed_ms            : %.3f\n", elapsed_ns / 1e6 );
+    printf( "ns_per_record         : %.1f\n", count ? elapsed_ns / (double)count : 0.0 );
+    printf( "peak_rss_kb           : %ld\n", usage.ru_maxrss );
+    if ( replay_use_pools )
+    {
+        size_t spills = 0;
+        size_t i;
+        for ( i = 0; i < replay_pools.num_pools; ++i )
+        {
+            spills += replay_pools.pool[i].diag_num_spills;
+        }
+        printf( "pool_spills           : %zu\n", spills );
+        printf( "spills_handled        : %zu\n", replay_pools.diag_num_spills_handled );
+        printf( "spills_to_heap        : %zu\n", replay_pools.diag_num_spills_to_heap );
+        printf( "\n" );
+        Pools_diagnostics( &replay_pools, "replay", replay_print );
+    }
+    return 0;
+}